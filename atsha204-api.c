@@ -0,0 +1,188 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * In-kernel client API of the ATSHA204 driver, see atsha204-api.h
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
+#include "atsha204-i2c.h"
+
+/* Chips that are probed and not yet removed */
+static LIST_HEAD(atsha204_chips);
+static DEFINE_MUTEX(atsha204_chips_lock);
+
+/* Runs atsha204_submit() requests */
+static struct workqueue_struct *atsha204_wq;
+
+struct atsha204_request {
+        struct work_struct work;
+        struct atsha204_chip *chip;
+        atsha204_done_t done;
+        void *ctx;
+        size_t cmd_len;
+        u8 cmd[];
+};
+
+void atsha204_api_add_device(struct atsha204_chip *chip)
+{
+        mutex_lock(&atsha204_chips_lock);
+        list_add_tail(&chip->node, &atsha204_chips);
+        mutex_unlock(&atsha204_chips_lock);
+}
+
+/*
+ * Stop handing out the chip and wait for commands already running on
+ * it. Anything submitted afterwards fails with -ENODEV.
+ */
+void atsha204_api_del_device(struct atsha204_chip *chip)
+{
+        mutex_lock(&atsha204_chips_lock);
+        list_del(&chip->node);
+        mutex_unlock(&atsha204_chips_lock);
+
+        down_write(&chip->remove_sem);
+        chip->dead = true;
+        up_write(&chip->remove_sem);
+}
+
+static struct atsha204_chip *atsha204_find(const char *name, int index)
+{
+        struct atsha204_chip *chip, *found = NULL;
+
+        mutex_lock(&atsha204_chips_lock);
+
+        list_for_each_entry(chip, &atsha204_chips, node){
+                if (name ? strcmp(chip->devname, name) :
+                    chip->dev_num != index)
+                        continue;
+
+                kref_get(&chip->kref);
+                found = chip;
+                break;
+        }
+
+        mutex_unlock(&atsha204_chips_lock);
+
+        return found;
+}
+
+/* Look a chip up by its misc device name, e.g. "atsha0" */
+struct atsha204_chip *atsha204_get(const char *name)
+{
+        return atsha204_find(name, 0);
+}
+EXPORT_SYMBOL_GPL(atsha204_get);
+
+struct atsha204_chip *atsha204_get_by_index(int index)
+{
+        return atsha204_find(NULL, index);
+}
+EXPORT_SYMBOL_GPL(atsha204_get_by_index);
+
+void atsha204_put(struct atsha204_chip *chip)
+{
+        if (chip)
+                kref_put(&chip->kref, atsha204_chip_release);
+}
+EXPORT_SYMBOL_GPL(atsha204_put);
+
+int atsha204_execute(struct atsha204_chip *chip, const u8 *cmd,
+                     size_t cmd_len, u8 *rsp, size_t rsp_len)
+{
+        struct atsha204_buffer packet = {0, 0};
+        struct atsha204_buffer msg;
+        int rc;
+
+        if ((rc = atsha204_execute_cmd(chip, cmd, cmd_len, &packet,
+                                       ATSHA204_PRIO_KERNEL)))
+                return rc;
+
+        if ((rc = atsha204_i2c_validate_rsp(&packet, &msg)) == 0){
+                if (msg.len > rsp_len)
+                        rc = -EMSGSIZE;
+                else{
+                        memcpy(rsp, msg.ptr, msg.len);
+                        rc = msg.len;
+                }
+        }
+
+        kfree(packet.ptr);
+
+        return rc;
+}
+EXPORT_SYMBOL_GPL(atsha204_execute);
+
+static void atsha204_request_work(struct work_struct *work)
+{
+        struct atsha204_request *req = container_of(work,
+                                                    struct atsha204_request,
+                                                    work);
+        u8 rsp[ATSHA204_RSP_MAX_LEN];
+        int rc;
+
+        rc = atsha204_execute(req->chip, req->cmd, req->cmd_len,
+                              rsp, sizeof(rsp));
+
+        req->done(req->ctx, rc, (rc > 0) ? rsp : NULL);
+
+        memzero_explicit(rsp, sizeof(rsp));
+        atsha204_put(req->chip);
+        kfree(req);
+}
+
+/*
+ * Queue a command and return at once. The request holds its own
+ * reference on the chip until done has run, so the caller may put its
+ * handle straight away.
+ */
+int atsha204_submit(struct atsha204_chip *chip, const u8 *cmd,
+                    size_t cmd_len, atsha204_done_t done, void *ctx)
+{
+        struct atsha204_request *req;
+        int rc;
+
+        if ((rc = validate_write_size(cmd_len)))
+                return rc;
+
+        if (READ_ONCE(chip->dead))
+                return -ENODEV;
+
+        if (!(req = kmalloc(sizeof(*req) + cmd_len, GFP_ATOMIC)))
+                return -ENOMEM;
+
+        INIT_WORK(&req->work, atsha204_request_work);
+        req->done = done;
+        req->ctx = ctx;
+        req->cmd_len = cmd_len;
+        memcpy(req->cmd, cmd, cmd_len);
+
+        kref_get(&chip->kref);
+        req->chip = chip;
+
+        queue_work(atsha204_wq, &req->work);
+
+        return 0;
+}
+EXPORT_SYMBOL_GPL(atsha204_submit);
+
+int atsha204_api_init(void)
+{
+        atsha204_wq = alloc_workqueue("atsha204", WQ_UNBOUND, 0);
+
+        return atsha204_wq ? 0 : -ENOMEM;
+}
+
+void atsha204_api_exit(void)
+{
+        destroy_workqueue(atsha204_wq);
+}
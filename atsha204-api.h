@@ -0,0 +1,48 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * In-kernel interface of the ATSHA204 driver
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * For other kernel modules. Commands have the same layout as writes
+ * to /dev/atshaX: opcode, param1, param2 (little endian) and data. The
+ * driver adds the count and CRC, and refuses commands the config zone
+ * rules out with -EACCES. Responses are returned without the count
+ * and CRC, so a bare status is a single byte.
+ *
+ *     struct atsha204_chip *chip = atsha204_get("atsha0");
+ *
+ *     if (chip){
+ *             rc = atsha204_execute(chip, cmd, sizeof(cmd),
+ *                                   rsp, sizeof(rsp));
+ *             atsha204_put(chip);
+ *     }
+ *
+ * A handle stays valid until it is put, even if the chip is removed;
+ * commands on a removed chip fail with -ENODEV.
+ */
+#ifndef _ATSHA204_API_H_
+#define _ATSHA204_API_H_
+
+#include <linux/types.h>
+
+struct atsha204_chip;
+
+/* rc is the response length or a negative errno */
+typedef void (*atsha204_done_t)(void *ctx, int rc, const u8 *rsp);
+
+struct atsha204_chip *atsha204_get(const char *name);
+struct atsha204_chip *atsha204_get_by_index(int index);
+void atsha204_put(struct atsha204_chip *chip);
+
+/* May sleep. Returns the response length */
+int atsha204_execute(struct atsha204_chip *chip, const u8 *cmd,
+                     size_t cmd_len, u8 *rsp, size_t rsp_len);
+
+/* Does not sleep. done runs later from process context */
+int atsha204_submit(struct atsha204_chip *chip, const u8 *cmd,
+                    size_t cmd_len, atsha204_done_t done, void *ctx);
+
+#endif /* _ATSHA204_API_H_ */
@@ -0,0 +1,301 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * Chip seeded DRBG endpoint for the ATSHA204
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The chip gives out at most 32 bytes per Random command, which takes
+ * tens of milliseconds. /dev/atshaX-drbg serves bulk readers from a
+ * kernel crypto API DRBG instead, and only goes to the chip for
+ * reseed material once enough bytes or time have gone by.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <crypto/rng.h>
+#include "atsha204-i2c.h"
+
+/* Two Random commands: entropy plus nonce for a 256 bit CTR DRBG */
+#define ATSHA204_DRBG_SEED_LEN 64
+#define ATSHA204_DRBG_CHUNK (4 * PAGE_SIZE)
+
+static bool drbg;
+module_param(drbg, bool, 0444);
+MODULE_PARM_DESC(drbg, "Create /dev/atshaX-drbg, a DRBG seeded by the chip");
+
+static char *drbg_alg = "drbg_nopr_ctr_aes256";
+module_param(drbg_alg, charp, 0444);
+MODULE_PARM_DESC(drbg_alg, "Crypto API rng backing /dev/atshaX-drbg");
+
+static unsigned long drbg_reseed_bytes = 16 * 1024 * 1024;
+module_param(drbg_reseed_bytes, ulong, 0644);
+MODULE_PARM_DESC(drbg_reseed_bytes,
+                 "Reseed from the chip after this many bytes of output");
+
+static unsigned int drbg_reseed_secs = 60;
+module_param(drbg_reseed_secs, uint, 0644);
+MODULE_PARM_DESC(drbg_reseed_secs,
+                 "Reseed from the chip after this many seconds");
+
+/*
+ * Fetch fresh seed material from the chip and reset the DRBG with it.
+ * The bus work happens before drbg_lock is taken so readers keep
+ * being served from the old state in the meantime.
+ */
+static int atsha204_drbg_seed(struct atsha204_chip *chip)
+{
+        u8 seed[ATSHA204_DRBG_SEED_LEN];
+        int filled = 0;
+        int rc;
+
+        while (filled < sizeof(seed)){
+                rc = atsha204_i2c_random(chip, &seed[filled],
+                                         sizeof(seed) - filled,
+                                         ATSHA204_PRIO_RNG);
+                if (rc <= 0){
+                        rc = rc ? rc : -EIO;
+                        goto out;
+                }
+
+                filled += rc;
+        }
+
+        mutex_lock(&chip->drbg_lock);
+
+        if (chip->drbg_dead)
+                rc = -ENODEV;
+        else if ((rc = crypto_rng_reset(chip->drbg, seed,
+                                        sizeof(seed))) == 0){
+                chip->drbg_bytes = 0;
+                chip->drbg_seeded_at = jiffies;
+        }
+
+        mutex_unlock(&chip->drbg_lock);
+
+out:
+        memzero_explicit(seed, sizeof(seed));
+
+        if (rc < 0)
+                dev_err(chip->dev, "%s: %d\n", "DRBG reseed failed", rc);
+
+        return (rc < 0) ? rc : 0;
+}
+
+/* Drops the reference taken by atsha204_drbg_queue_reseed() */
+static void atsha204_drbg_reseed_work(struct work_struct *work)
+{
+        struct atsha204_chip *chip = container_of(work, struct atsha204_chip,
+                                                  drbg_reseed_work);
+        bool dead;
+
+        mutex_lock(&chip->drbg_lock);
+        dead = chip->drbg_dead;
+        mutex_unlock(&chip->drbg_lock);
+
+        if (!dead)
+                atsha204_drbg_seed(chip);
+
+        kref_put(&chip->kref, atsha204_chip_release);
+}
+
+/*
+ * Called with drbg_lock held, so removal can't slip in between the
+ * dead check and the work being queued. The queued work holds a
+ * reference on the chip.
+ */
+static void atsha204_drbg_queue_reseed(struct atsha204_chip *chip)
+{
+        if (chip->drbg_dead)
+                return;
+
+        kref_get(&chip->kref);
+        if (!schedule_work(&chip->drbg_reseed_work))
+                kref_put(&chip->kref, atsha204_chip_release);
+}
+
+/* Called with drbg_lock held */
+static bool atsha204_drbg_needs_reseed(struct atsha204_chip *chip)
+{
+        return chip->drbg_bytes >= drbg_reseed_bytes ||
+                time_after(jiffies, chip->drbg_seeded_at +
+                           drbg_reseed_secs * HZ);
+}
+
+/*
+ * An open file holds a reference on the chip, so the DRBG state stays
+ * around until it is closed even if the chip is removed first.
+ */
+static int atsha204_drbg_open(struct inode *inode, struct file *filep)
+{
+        struct miscdevice *misc = filep->private_data;
+        struct atsha204_chip *chip = container_of(misc, struct atsha204_chip,
+                                                  drbg_miscdev);
+
+        kref_get(&chip->kref);
+        filep->private_data = chip;
+
+        return 0;
+}
+
+static int atsha204_drbg_release(struct inode *inode, struct file *filep)
+{
+        struct atsha204_chip *chip = filep->private_data;
+
+        kref_put(&chip->kref, atsha204_chip_release);
+
+        return 0;
+}
+
+static ssize_t atsha204_drbg_read(struct file *filep, char __user *buf,
+                                  size_t count, loff_t *f_pos)
+{
+        struct atsha204_chip *chip = filep->private_data;
+        size_t done = 0;
+        size_t chunk;
+        int rc = 0;
+
+        if (mutex_lock_interruptible(&chip->drbg_lock))
+                return -ERESTARTSYS;
+
+        if (chip->drbg_dead){
+                mutex_unlock(&chip->drbg_lock);
+                return -ENODEV;
+        }
+
+        while (done < count){
+                chunk = min_t(size_t, count - done, ATSHA204_DRBG_CHUNK);
+
+                if ((rc = crypto_rng_get_bytes(chip->drbg, chip->drbg_buf,
+                                               chunk)) < 0)
+                        break;
+
+                if (copy_to_user(buf + done, chip->drbg_buf, chunk)){
+                        rc = -EFAULT;
+                        break;
+                }
+
+                done += chunk;
+                chip->drbg_bytes += chunk;
+
+                if (signal_pending(current))
+                        break;
+
+                cond_resched();
+        }
+
+        memzero_explicit(chip->drbg_buf, ATSHA204_DRBG_CHUNK);
+
+        /* Reseeding waits on the chip, keep it off the read path */
+        if (atsha204_drbg_needs_reseed(chip))
+                atsha204_drbg_queue_reseed(chip);
+
+        mutex_unlock(&chip->drbg_lock);
+
+        return done ? done : rc;
+}
+
+static const struct file_operations atsha204_drbg_fops = {
+        .owner = THIS_MODULE,
+        .llseek = no_llseek,
+        .open = atsha204_drbg_open,
+        .read = atsha204_drbg_read,
+        .release = atsha204_drbg_release,
+};
+
+int atsha204_drbg_add_device(struct atsha204_chip *chip)
+{
+        int rc;
+
+        if (!drbg)
+                return 0;
+
+        mutex_init(&chip->drbg_lock);
+        INIT_WORK(&chip->drbg_reseed_work, atsha204_drbg_reseed_work);
+
+        chip->drbg = crypto_alloc_rng(drbg_alg, 0, 0);
+        if (IS_ERR(chip->drbg)){
+                rc = PTR_ERR(chip->drbg);
+                dev_err(chip->dev, "%s %s: %d\n", "Can't allocate",
+                        drbg_alg, rc);
+                chip->drbg = NULL;
+                return rc;
+        }
+
+        if (!(chip->drbg_buf = kmalloc(ATSHA204_DRBG_CHUNK, GFP_KERNEL))){
+                rc = -ENOMEM;
+                goto out_free_rng;
+        }
+
+        /* Never hand out bytes before the chip has seeded the DRBG */
+        if ((rc = atsha204_drbg_seed(chip)))
+                goto out_free_buf;
+
+        scnprintf(chip->drbg_name, sizeof(chip->drbg_name), "%s-drbg",
+                  chip->devname);
+
+        chip->drbg_miscdev.fops = &atsha204_drbg_fops;
+        chip->drbg_miscdev.minor = MISC_DYNAMIC_MINOR;
+        chip->drbg_miscdev.name = chip->drbg_name;
+        chip->drbg_miscdev.parent = chip->dev;
+
+        if ((rc = misc_register(&chip->drbg_miscdev))){
+                dev_err(chip->dev, "unable to misc_register %s, err=%d\n",
+                        chip->drbg_name, rc);
+                goto out_free_buf;
+        }
+
+        chip->drbg_registered = true;
+
+        return 0;
+
+out_free_buf:
+        kfree(chip->drbg_buf);
+        chip->drbg_buf = NULL;
+out_free_rng:
+        crypto_free_rng(chip->drbg);
+        chip->drbg = NULL;
+        return rc;
+}
+
+/*
+ * Files that are still open only get -ENODEV from here on, and no
+ * longer queue reseeds. The DRBG itself is freed with the chip, see
+ * atsha204_drbg_free().
+ */
+void atsha204_drbg_del_device(struct atsha204_chip *chip)
+{
+        if (!chip->drbg_registered)
+                return;
+
+        misc_deregister(&chip->drbg_miscdev);
+
+        mutex_lock(&chip->drbg_lock);
+        chip->drbg_dead = true;
+        mutex_unlock(&chip->drbg_lock);
+
+        /* A reseed that never ran still holds its chip reference. The
+           caller holds one too, so this put can't free the chip */
+        if (cancel_work_sync(&chip->drbg_reseed_work))
+                kref_put(&chip->kref, atsha204_chip_release);
+
+        chip->drbg_registered = false;
+}
+
+void atsha204_drbg_free(struct atsha204_chip *chip)
+{
+        if (chip->drbg)
+                crypto_free_rng(chip->drbg);
+        kfree(chip->drbg_buf);
+
+        chip->drbg = NULL;
+        chip->drbg_buf = NULL;
+}
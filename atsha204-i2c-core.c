@@ -0,0 +1,2006 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+* I2C Driver for Atmel ATSHA204 over I2C
+*
+* Copyright (C) 2014 Josh Datko, Cryptotronix, jbd@cryptotronix.com
+*
+* This program is free software; you can redistribute  it and/or modify it
+* under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/kfifo.h>
+#include <linux/uaccess.h>
+#include <linux/crc16.h>
+#include <linux/bitrev.h>
+#include <linux/delay.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/printk.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/idr.h>
+#include "atsha204-i2c.h"
+
+/* Hands out the X in atshaX */
+static DEFINE_IDA(atsha204_ida);
+
+static bool bus_share;
+module_param(bus_share, bool, 0644);
+MODULE_PARM_DESC(bus_share,
+                 "Release the I2C adapter while the chip executes a command");
+
+static unsigned int sched_starve_ms = 200;
+module_param(sched_starve_ms, uint, 0644);
+MODULE_PARM_DESC(sched_starve_ms,
+                 "Queue wait in ms after which a request of any class runs next");
+
+int atsha204_i2c_random(struct atsha204_chip *chip, u8 *to_fill,
+                        const size_t max, enum atsha204_prio prio)
+{
+        int rc;
+        struct atsha204_buffer recv = {0,0};
+        int rnd_len;
+
+        const u8 rand_cmd[] = {0x03, 0x07, 0x1b, 0x01, 0x00, 0x00, 0x27, 0x47};
+
+        rc = atsha204_i2c_transaction(chip, rand_cmd, sizeof(rand_cmd),
+                                      &recv, prio);
+        if (sizeof(rand_cmd) == rc){
+
+                if (!atsha204_check_rsp_crc16(recv.ptr, recv.len)){
+                        rc = -EBADMSG;
+                        dev_err(chip->dev, "%s\n", "Bad CRC on Random");
+                }
+                /* A status packet is an error code, not randomness */
+                else if (ATSHA204_BLOCK_SIZE + 3 != recv.len){
+                        rc = -EIO;
+                        dev_err(chip->dev, "%s: 0x%02x\n",
+                                "Random failed, status", recv.ptr[1]);
+                }
+                else{
+                        rnd_len = (max > recv.len - 3) ? recv.len - 3 : max;
+                        memcpy(to_fill, &recv.ptr[1], rnd_len);
+                        rc = rnd_len;
+                        dev_dbg(chip->dev, "%s: %d\n",
+                                "Returning randoom bytes", rc);
+                }
+
+                kfree(recv.ptr);
+        }
+
+        return rc;
+
+
+}
+
+/* All bus traffic goes through the chip's transport */
+int atsha204_i2c_send(struct atsha204_chip *chip, const u8 *buf, int len)
+{
+        return chip->transport->send(chip, buf, len);
+}
+
+int atsha204_i2c_recv(struct atsha204_chip *chip, u8 *buf, int len)
+{
+        return chip->transport->recv(chip, buf, len);
+}
+
+void atsha204_sched_init(struct atsha204_chip *chip)
+{
+        int i;
+
+        spin_lock_init(&chip->sched_lock);
+
+        for (i = 0; i < ATSHA204_PRIO_COUNT; i++)
+                INIT_LIST_HEAD(&chip->sched_queue[i]);
+
+        chip->sched_busy = false;
+
+        spin_lock_init(&chip->flight_lock);
+        INIT_LIST_HEAD(&chip->flights);
+}
+
+/*
+ * Pick who runs next: the longest waiter of any class that has been
+ * waiting past sched_starve_ms, otherwise the head of the highest
+ * priority class. Each class is FIFO so only the heads need looking
+ * at. Called with sched_lock held.
+ */
+static struct atsha204_waiter *atsha204_sched_next(struct atsha204_chip *chip)
+{
+        struct atsha204_waiter *w, *best = NULL, *starved = NULL;
+        const unsigned long limit = msecs_to_jiffies(sched_starve_ms);
+        int i;
+
+        for (i = 0; i < ATSHA204_PRIO_COUNT; i++){
+                w = list_first_entry_or_null(&chip->sched_queue[i],
+                                             struct atsha204_waiter, node);
+                if (!w)
+                        continue;
+
+                if (!best)
+                        best = w;
+
+                if (time_after(jiffies, w->since + limit) &&
+                    (!starved || time_before(w->since, starved->since)))
+                        starved = w;
+        }
+
+        return starved ? starved : best;
+}
+
+static void atsha204_sched_waiter_init(struct atsha204_waiter *w,
+                                       enum atsha204_prio prio)
+{
+        if ((unsigned int)prio >= ATSHA204_PRIO_COUNT)
+                prio = ATSHA204_PRIO_SYSFS;
+
+        init_completion(&w->granted);
+        w->prio = prio;
+        w->queued = false;
+}
+
+/*
+ * Wait until the chip is ours. The chip is handed directly from the
+ * releasing request to the chosen waiter, so a late arrival can never
+ * jump a queue that already has someone in it.
+ */
+static void atsha204_sched_wait(struct atsha204_chip *chip,
+                                struct atsha204_waiter *w)
+{
+        spin_lock(&chip->sched_lock);
+
+        if (!chip->sched_busy){
+                chip->sched_busy = true;
+                spin_unlock(&chip->sched_lock);
+                return;
+        }
+
+        w->since = jiffies;
+        w->queued = true;
+        list_add_tail(&w->node, &chip->sched_queue[w->prio]);
+
+        spin_unlock(&chip->sched_lock);
+
+        wait_for_completion(&w->granted);
+}
+
+void atsha204_sched_acquire(struct atsha204_chip *chip,
+                            enum atsha204_prio prio)
+{
+        struct atsha204_waiter w;
+
+        atsha204_sched_waiter_init(&w, prio);
+        atsha204_sched_wait(chip, &w);
+}
+
+/*
+ * Move a waiter up to class prio if that is higher than its own. It
+ * keeps its original arrival time for the starvation check. A waiter
+ * that is not queued yet will queue at the new class.
+ */
+static void atsha204_sched_boost(struct atsha204_chip *chip,
+                                 struct atsha204_waiter *w,
+                                 enum atsha204_prio prio)
+{
+        if ((unsigned int)prio >= ATSHA204_PRIO_COUNT)
+                return;
+
+        spin_lock(&chip->sched_lock);
+
+        if (prio < w->prio){
+                w->prio = prio;
+                if (w->queued)
+                        list_move_tail(&w->node, &chip->sched_queue[prio]);
+        }
+
+        spin_unlock(&chip->sched_lock);
+}
+
+void atsha204_sched_release(struct atsha204_chip *chip)
+{
+        struct atsha204_waiter *next;
+
+        spin_lock(&chip->sched_lock);
+
+        if ((next = atsha204_sched_next(chip))){
+                /* sched_busy stays set, ownership moves to next */
+                list_del(&next->node);
+                next->queued = false;
+                complete(&next->granted);
+        }
+        else
+                chip->sched_busy = false;
+
+        spin_unlock(&chip->sched_lock);
+}
+
+/*
+ * Mark the start and end of a stretch where the chip is using the
+ * bus. In bus sharing mode this also takes and drops the adapter lock
+ * so other masters can't split a wake/send or read sequence.
+ */
+static void atsha204_i2c_bus_get(struct atsha204_chip *chip)
+{
+        if (chip->bus_share){
+                chip->transport->lock(chip);
+                chip->bus_locked = true;
+        }
+
+        chip->bus_since = ktime_get();
+}
+
+static void atsha204_i2c_bus_put(struct atsha204_chip *chip)
+{
+        atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), chip->bus_since)),
+                     &chip->bus_busy_ns);
+
+        if (chip->bus_locked){
+                chip->bus_locked = false;
+                chip->transport->unlock(chip);
+        }
+}
+
+static void atsha204_i2c_trace(struct atsha204_chip *chip,
+                               const u8 *to_send, size_t to_send_len,
+                               const struct atsha204_buffer *rsp, int rc,
+                               enum atsha204_prio prio, ktime_t submitted,
+                               ktime_t granted, ktime_t done, u8 flags)
+{
+        const u8 *cmd = &to_send[ATSHA204_CMD_OFFSET];
+        struct atsha204_trace_rec rec = {
+                .timestamp_ns = ktime_to_ns(submitted),
+                .latency_us = ktime_us_delta(done, submitted),
+                .queue_us = ktime_us_delta(granted, submitted),
+                .tx_len = to_send_len - ATSHA204_PACKET_LEN(0),
+                .opcode = cmd[0],
+                .param1 = cmd[1],
+                .param2 = cmd[2] | (cmd[3] << 8),
+                .prio = prio,
+                .flags = flags,
+        };
+
+        if (rsp){
+                rec.rx_len = rsp->len - 3;
+                if (ATSHA204_RSP_MIN_LEN == rsp->len)
+                        rec.chip_status = rsp->ptr[1];
+        }
+        else
+                rec.error = (rc < 0) ? rc : -EIO;
+
+        atsha204_trace_record(chip, &rec);
+}
+
+/* A NACK while polling only means the chip is still executing */
+static bool atsha204_i2c_is_nack(int rc)
+{
+        return -ENXIO == rc || -EREMOTEIO == rc || -EIO == rc;
+}
+
+/*
+ * One wake, send, poll and receive round with the chip. On any
+ * failure after the chip is awake it is idled again so it doesn't
+ * sit there until the watchdog fires. sent tells whether the chip
+ * took the whole command, and so may have executed it.
+ */
+static int atsha204_i2c_exchange(struct atsha204_chip *chip,
+                                 const u8 *to_send, size_t to_send_len,
+                                 struct atsha204_buffer *buf, bool *sent)
+{
+        int rc;
+        u8 status_packet[4] = {0};
+        u8 *recv_buf;
+        const unsigned int exec_ms =
+                atsha204_exec_time_ms(READ_ONCE(chip->variant),
+                                      to_send[ATSHA204_CMD_OFFSET]);
+        int total_sleep = exec_ms + ATSHA204_POLL_MARGIN_MS;
+        int packet_len;
+
+        *sent = false;
+
+        /* Begin i2c transactions */
+        atsha204_i2c_bus_get(chip);
+
+        if ((rc = atsha204_i2c_wakeup(chip)))
+                goto out_put;
+
+        if ((rc = atsha204_i2c_send(chip, to_send, to_send_len))
+            != to_send_len){
+                rc = (rc < 0) ? rc : -EIO;
+                goto out_idle;
+        }
+
+        *sent = true;
+
+        /* Leave the bus alone for as long as the command can take,
+           instead of NACK polling through it */
+        if (chip->bus_share){
+                atsha204_i2c_bus_put(chip);
+                msleep(exec_ms);
+                atsha204_i2c_bus_get(chip);
+        }
+
+        /* Poll for the response. Anything but a NACK is a bus fault */
+        while ((rc = atsha204_i2c_recv(chip, status_packet, 4)) != 4){
+                if (!atsha204_i2c_is_nack(rc))
+                        goto out_idle;
+
+                if (total_sleep <= 0){
+                        rc = -ETIMEDOUT;
+                        goto out_idle;
+                }
+
+                total_sleep = total_sleep - 4;
+
+                if (chip->bus_share){
+                        atsha204_i2c_bus_put(chip);
+                        msleep(4);
+                        atsha204_i2c_bus_get(chip);
+                }
+                else
+                        msleep(4);
+        }
+
+        if ((packet_len = atsha204_rsp_packet_len(status_packet)) < 0){
+                dev_err(chip->dev, "%s: %d\n", "Bad response length",
+                        status_packet[0]);
+                rc = packet_len;
+                goto out_idle;
+        }
+
+        /* The device is awake and we don't want to hit the watchdog
+           timer, so don't allow sleeps here*/
+        recv_buf = kmalloc(packet_len, GFP_ATOMIC);
+        if (!recv_buf){
+                rc = -ENOMEM;
+                goto out_idle;
+        }
+
+        memcpy(recv_buf, status_packet, sizeof(status_packet));
+
+        if (packet_len > sizeof(status_packet) &&
+            (rc = atsha204_i2c_recv(chip, recv_buf + 4, packet_len - 4))
+            != packet_len - 4){
+                kfree(recv_buf);
+                rc = (rc < 0) ? rc : -EIO;
+                goto out_idle;
+        }
+
+        /* A corrupted response is a bus glitch, not a chip answer */
+        if (!atsha204_check_rsp_crc16(recv_buf, packet_len)){
+                kfree(recv_buf);
+                rc = -EBADMSG;
+                goto out_idle;
+        }
+
+        /* Store the entire packet. Other functions must check the CRC
+           and strip of the length byte */
+        buf->ptr = recv_buf;
+        buf->len = packet_len;
+
+        dev_dbg(chip->dev, "%s\n", "Received from device.");
+        print_hex_dump_bytes("Received: ", DUMP_PREFIX_OFFSET,
+                             recv_buf, packet_len);
+
+        rc = to_send_len;
+out_idle:
+        atsha204_i2c_idle(chip);
+out_put:
+        atsha204_i2c_bus_put(chip);
+        return rc;
+}
+
+/*
+ * Take one recovery step after a failed exchange. The steps get more
+ * disruptive: wait and wake again, put the chip through a full
+ * sleep/wake cycle, then ask the adapter to clock a stuck bus free.
+ */
+static void atsha204_i2c_recover(struct atsha204_chip *chip,
+                                 enum atsha204_recovery step, int err)
+{
+        const unsigned int twhi = READ_ONCE(chip->variant)->wake_delay_us;
+
+        dev_warn_ratelimited(chip->dev, "%s %d: %d\n",
+                             "Exchange failed, recovery step", step, err);
+
+        atomic_inc(&chip->recoveries[step]);
+
+        switch (step){
+        case ATSHA204_RECOVER_REWAKE:
+                /* Let a command we lost track of run to completion */
+                usleep_range(twhi, 2 * twhi);
+                break;
+        case ATSHA204_RECOVER_RESET:
+                /* Sleep clears the chip's volatile state, including
+                   anything half received */
+                atsha204_i2c_bus_get(chip);
+                if (0 == atsha204_i2c_wakeup(chip))
+                        atsha204_i2c_sleep(chip);
+                atsha204_i2c_bus_put(chip);
+                usleep_range(twhi, 2 * twhi);
+                break;
+        case ATSHA204_RECOVER_BUS:
+                chip->transport->recover(chip);
+                break;
+        default:
+                break;
+        }
+}
+
+/*
+ * Commands that can run twice without the caller noticing: they only
+ * read stored data, or their answer is fresh each time anyway.
+ */
+static bool atsha204_replayable(const u8 *cmd)
+{
+        switch (cmd[0]){
+        case ATSHA204_OP_READ:
+        case ATSHA204_OP_DEVREV:
+        case ATSHA204_OP_RANDOM:
+                return true;
+        default:
+                return false;
+        }
+}
+
+/*
+ * Close the flight to new followers. This has to happen while the
+ * leader still owns the scheduler: once it lets go, a Write or Lock
+ * can run, and a Read issued after that must not get the old answer.
+ */
+static void atsha204_flight_delist(struct atsha204_chip *chip,
+                                   struct atsha204_flight *flight)
+{
+        spin_lock(&chip->flight_lock);
+        list_del(&flight->node);
+        spin_unlock(&chip->flight_lock);
+}
+
+/*
+ * Commands that work on what earlier commands left in the chip's
+ * volatile state: TempKey, or a SHA computation already started. A
+ * sleep/wake cycle clears that state, so after one these would run on
+ * nothing, or on a TempKey the caller never asked for.
+ */
+static bool atsha204_needs_volatile(const u8 *cmd)
+{
+        switch (cmd[0]){
+        case ATSHA204_OP_HMAC:
+        case ATSHA204_OP_GENDIG:
+        case ATSHA204_OP_DERIVEKEY:
+        case ATSHA204_OP_SIGN:
+        case ATSHA204_OP_VERIFY:
+                return true;
+        case ATSHA204_OP_MAC:
+        case ATSHA204_OP_CHECKMAC:
+                /* Either 32 byte input taken from TempKey */
+                return cmd[1] & 0x03;
+        case ATSHA204_OP_WRITE:
+        case ATSHA204_OP_PRIVWRITE:
+                /* Data encrypted with TempKey */
+                return cmd[1] & 0x40;
+        case ATSHA204_OP_GENKEY:
+                /* Digest over TempKey */
+                return cmd[1] & 0x10;
+        case ATSHA204_OP_SHA:
+                /* Anything but starting a new digest or HMAC */
+                return 0x00 != (cmd[1] & 0x07) && 0x04 != (cmd[1] & 0x07);
+        default:
+                return false;
+        }
+}
+
+/*
+ * Run one command against the chip. A failed exchange is replayed
+ * after each recovery step; the scheduler stays held throughout, so
+ * queued requests wait for the chip to come back rather than each
+ * running into the same fault. Once the chip has taken the whole
+ * command it may have executed it, so from then on only replayable
+ * commands are run again. Anything else gets the chip back to a
+ * known state and the error goes to the caller, rather than bumping
+ * a Counter twice or failing a Lock that went through.
+ */
+static int atsha204_i2c_run(struct atsha204_chip *chip,
+                            const u8* to_send, size_t to_send_len,
+                            struct atsha204_buffer *buf,
+                            enum atsha204_prio prio,
+                            struct atsha204_waiter *waiter,
+                            struct atsha204_flight *flight)
+{
+        int rc;
+        int step;
+        bool sent;
+        bool bus_fault = false;
+        const bool replayable =
+                atsha204_replayable(&to_send[ATSHA204_CMD_OFFSET]);
+        /* The last step that leaves the chip's volatile state alone */
+        const int last_step =
+                atsha204_needs_volatile(&to_send[ATSHA204_CMD_OFFSET]) ?
+                ATSHA204_RECOVER_RESET : ATSHA204_RECOVER_STEPS;
+        const ktime_t submitted = ktime_get();
+        ktime_t granted, done;
+
+        atsha204_sched_wait(chip, waiter);
+        granted = ktime_get();
+
+        dev_dbg(chip->dev, "%s\n", "About to send to device.");
+        print_hex_dump_bytes("Sending : ", DUMP_PREFIX_OFFSET,
+                             to_send, to_send_len);
+
+        /* Sampled once so the mode can't change under a transaction */
+        chip->bus_share = bus_share;
+
+        for (step = ATSHA204_RECOVER_REWAKE; ; step++){
+                rc = atsha204_i2c_exchange(chip, to_send, to_send_len, buf,
+                                           &sent);
+
+                /* Nothing to recover from when the command can't be
+                   sent at all */
+                if (rc == to_send_len || -ENOMEM == rc || -EMSGSIZE == rc)
+                        break;
+
+                /* Anything but an unanswered wake pulse */
+                if (-ENODEV != rc)
+                        bus_fault = true;
+
+                /* Let the command run out, but don't run it again */
+                if (sent && !replayable){
+                        atsha204_i2c_recover(chip, ATSHA204_RECOVER_REWAKE,
+                                             rc);
+                        break;
+                }
+
+                /* Clocking the bus free won't help a chip that just
+                   doesn't answer its wake pulse */
+                if (last_step == step ||
+                    (ATSHA204_RECOVER_BUS == step && !bus_fault)){
+                        atomic_inc(&chip->recovery_failed);
+                        dev_err_ratelimited(chip->dev, "%s: %d\n",
+                                            "Chip did not recover", rc);
+                        break;
+                }
+
+                atsha204_i2c_recover(chip, step, rc);
+        }
+
+        done = ktime_get();
+
+        if (flight)
+                atsha204_flight_delist(chip, flight);
+
+        atsha204_sched_release(chip);
+
+        if (chip->trace_enabled)
+                atsha204_i2c_trace(chip, to_send, to_send_len,
+                                   (rc == to_send_len) ? buf : NULL,
+                                   rc, prio, submitted, granted, done, 0);
+
+        return rc;
+
+}
+
+
+/*
+ * Commands whose answer depends only on what the chip has stored:
+ * DevRev and Reads of the config and OTP zones. Data zone Reads may
+ * be encrypted with TempKey, so they are never merged, nor is any
+ * command that uses or changes volatile state (Random, Nonce, MAC...).
+ */
+static bool atsha204_coalescable(const u8 *cmd)
+{
+        switch (cmd[0]){
+        case ATSHA204_OP_DEVREV:
+                return true;
+        case ATSHA204_OP_READ:
+                return ATSHA204_ZONE_CONFIG == (cmd[1] & 0x03) ||
+                        ATSHA204_ZONE_OTP == (cmd[1] & 0x03);
+        default:
+                return false;
+        }
+}
+
+/*
+ * Join an identical command that is queued or running, lifting the
+ * leader to our class if it is still queued below it. Returns false
+ * with the command registered as a new flight if there is none.
+ */
+static bool atsha204_flight_join(struct atsha204_chip *chip,
+                                 struct atsha204_flight *flight,
+                                 struct atsha204_follower *follower,
+                                 enum atsha204_prio prio)
+{
+        struct atsha204_flight *f;
+
+        spin_lock(&chip->flight_lock);
+
+        list_for_each_entry(f, &chip->flights, node){
+                if (f->len != flight->len ||
+                    memcmp(f->packet, flight->packet, f->len))
+                        continue;
+
+                init_completion(&follower->done);
+                list_add_tail(&follower->node, &f->followers);
+
+                /* The leader can't land and take its waiter with it
+                   while flight_lock is held */
+                atsha204_sched_boost(chip, f->waiter, prio);
+
+                spin_unlock(&chip->flight_lock);
+                return true;
+        }
+
+        INIT_LIST_HEAD(&flight->followers);
+        list_add_tail(&flight->node, &chip->flights);
+
+        spin_unlock(&chip->flight_lock);
+
+        return false;
+}
+
+/* Give every follower its own copy of the leader's result */
+static void atsha204_flight_land(struct atsha204_chip *chip,
+                                 struct atsha204_flight *flight, int rc,
+                                 const struct atsha204_buffer *buf)
+{
+        struct atsha204_follower *follower, *tmp;
+
+        /* Nobody can join once the flight is off the list */
+        list_for_each_entry_safe(follower, tmp, &flight->followers, node){
+                follower->rc = rc;
+                follower->rsp.ptr = NULL;
+                follower->rsp.len = 0;
+
+                if (rc == flight->len){
+                        follower->rsp.ptr = kmemdup(buf->ptr, buf->len,
+                                                    GFP_KERNEL);
+                        follower->rsp.len = buf->len;
+                        if (!follower->rsp.ptr)
+                                follower->rc = -ENOMEM;
+                }
+
+                atomic_inc(&chip->coalesced);
+                complete(&follower->done);
+        }
+}
+
+/*
+ * Send a framed command and return the whole response packet in buf,
+ * which the caller must free. Identical idempotent commands submitted
+ * while one is queued or running are answered with a copy of its
+ * response instead of going to the chip again. A follower of a higher
+ * class than a queued leader moves the leader up to its class, so a
+ * merge never makes anyone wait longer than they would have alone.
+ */
+int atsha204_i2c_transaction(struct atsha204_chip *chip,
+                             const u8* to_send, size_t to_send_len,
+                             struct atsha204_buffer *buf,
+                             enum atsha204_prio prio)
+{
+        struct atsha204_waiter waiter;
+        struct atsha204_flight flight = {
+                .packet = to_send,
+                .len = to_send_len,
+                .waiter = &waiter,
+        };
+        struct atsha204_follower follower;
+        ktime_t submitted, done;
+        int rc;
+
+        atsha204_sched_waiter_init(&waiter, prio);
+
+        if (!atsha204_coalescable(&to_send[ATSHA204_CMD_OFFSET]))
+                return atsha204_i2c_run(chip, to_send, to_send_len, buf,
+                                        prio, &waiter, NULL);
+
+        submitted = ktime_get();
+
+        if (atsha204_flight_join(chip, &flight, &follower, prio)){
+                wait_for_completion(&follower.done);
+                done = ktime_get();
+
+                /* A follower never owns the chip, so all of its time
+                   counts as queued */
+                if (chip->trace_enabled)
+                        atsha204_i2c_trace(chip, to_send, to_send_len,
+                                           (follower.rc == to_send_len) ?
+                                           &follower.rsp : NULL,
+                                           follower.rc, prio, submitted,
+                                           done, done,
+                                           ATSHA204_TRACE_JOINED);
+
+                *buf = follower.rsp;
+                return follower.rc;
+        }
+
+        rc = atsha204_i2c_run(chip, to_send, to_send_len, buf, prio,
+                              &waiter, &flight);
+
+        atsha204_flight_land(chip, &flight, rc, buf);
+
+        return rc;
+}
+
+
+int atsha204_i2c_wakeup(struct atsha204_chip *chip)
+{
+        bool is_awake = false;
+        int retval = -ENODEV;
+        const unsigned int twhi = READ_ONCE(chip->variant)->wake_delay_us;
+        /* Count and status of the token the chip answers a wake with */
+        const u8 WAKE_TOKEN[2] = {0x04, 0x11};
+
+        u8 buf[4];
+
+        unsigned short int try_con = 1;
+        int rc;
+
+        while (!is_awake){
+                if (0 == (rc = chip->transport->wake(chip))){
+                        pr_debug("%s\n", "ATSHA204 Device is awake.");
+
+                        /* Zeros left from a failed read would pass the
+                           CRC check, so insist on the token itself */
+                        memset(buf, 0, sizeof(buf));
+
+                        if (sizeof(buf) == atsha204_i2c_recv(chip, buf,
+                                                             sizeof(buf)) &&
+                            0 == memcmp(buf, WAKE_TOKEN,
+                                        sizeof(WAKE_TOKEN)) &&
+                            atsha204_check_rsp_crc16(buf, sizeof(buf))){
+                                pr_debug("%s", "ATSHA204 Received wakeup\n");
+                                is_awake = true;
+                                retval = 0;
+                        }
+                        else{
+                                dev_warn_ratelimited(chip->dev, "%s\n",
+                                                     "bad wake token");
+                                retval = -EBADMSG;
+                        }
+                }
+                /* A NACK leaves -ENODEV only if nothing else went
+                   wrong, so recovery can tell a missing chip from a
+                   faulty bus */
+                else if (!atsha204_i2c_is_nack(rc))
+                        retval = rc;
+
+                if (!is_awake){
+                        dev_dbg(chip->dev, "Attempting Wakeup : %u\n",
+                                try_con);
+                        if(try_con >= ATSHA204_WAKE_TRIES){
+                                dev_dbg(chip->dev, "%s: %d\n",
+                                        "Wakeup Failed", retval);
+                                return retval;
+                        }
+
+                        /* Back to back retries all land inside tWHI */
+                        usleep_range(twhi, 2 * twhi);
+                }
+
+                ++try_con;
+        }
+
+        return retval;
+
+}
+
+
+int atsha204_i2c_idle(struct atsha204_chip *chip)
+{
+        int rc;
+
+        u8 idle_cmd[1] = {ATSHA204_IDLE};
+
+        rc = atsha204_i2c_send(chip, idle_cmd, 1);
+
+        return rc;
+
+}
+
+int atsha204_i2c_sleep(struct atsha204_chip *chip)
+{
+        int retval;
+        u8 to_send[1] = {ATSHA204_SLEEP};
+
+        if ((retval = atsha204_i2c_send(chip, to_send, 1)) == 1)
+                retval = 0;
+        else
+                pr_err("%s: 0x%x\n", "ATSHA204 failed to sleep",
+                       chip->client->addr);
+
+        return retval;
+
+}
+
+/* Lock and config zone Writes change what the chip allows */
+static bool atsha204_changes_config(const u8 *cmd)
+{
+        return ATSHA204_OP_LOCK == cmd[0] ||
+                (ATSHA204_OP_WRITE == cmd[0] &&
+                 ATSHA204_ZONE_CONFIG == (cmd[1] & 0x03));
+}
+
+/* Lock and config or OTP zone Writes change the mmap() snapshot */
+static bool atsha204_changes_snapshot(const u8 *cmd)
+{
+        return atsha204_changes_config(cmd) ||
+                (ATSHA204_OP_WRITE == cmd[0] &&
+                 ATSHA204_ZONE_OTP == (cmd[1] & 0x03));
+}
+
+/* A bare status packet with a zero status is the chip's "done" */
+static bool atsha204_rsp_success(const struct atsha204_buffer *rsp)
+{
+        return ATSHA204_RSP_MIN_LEN == rsp->len && 0x00 == rsp->ptr[1];
+}
+
+/* Rebuild the slot policy from a copy of the config zone */
+static int atsha204_policy_update(struct atsha204_chip *chip,
+                                  const u8 *config, size_t len)
+{
+        struct atsha204_policy policy;
+        int rc;
+
+        if ((rc = atsha204_parse_config(config, len,
+                                        READ_ONCE(chip->variant),
+                                        &policy)))
+                return rc;
+
+        spin_lock(&chip->policy_lock);
+        chip->policy = policy;
+        spin_unlock(&chip->policy_lock);
+
+        return 0;
+}
+
+/*
+ * Re-read the config zone and rebuild both the slot policy and the
+ * mmap() snapshot from that one read. Until the policy is built it is
+ * invalid and every command is passed through to the chip.
+ */
+int atsha204_config_refresh(struct atsha204_chip *chip)
+{
+        u8 config[ATSHA204_CONFIG_ZONE_SIZE];
+        ssize_t rc;
+        int snap_rc;
+        bool have_config;
+
+        rc = atsha204_i2c_read_zone(chip, ATSHA204_ZONE_CONFIG,
+                                    sizeof(config), config,
+                                    0, sizeof(config));
+        have_config = (sizeof(config) == rc);
+
+        if (have_config)
+                rc = atsha204_policy_update(chip, config, sizeof(config));
+        else if (rc >= 0)
+                rc = -EIO;
+
+        snap_rc = atsha204_snapshot_update(chip,
+                                           have_config ? config : NULL);
+
+        return rc ? rc : snap_rc;
+}
+
+/*
+ * Run a command given as opcode, params and data, the layout written
+ * to /dev/atshaX. This is the path shared by the char device and the
+ * in-kernel API: the command is checked against the config zone,
+ * framed and run, and the policy and snapshot are brought up to date
+ * after a Lock or Write. On success rsp owns the whole response
+ * packet.
+ */
+int atsha204_execute_cmd(struct atsha204_chip *chip, const u8 *cmd,
+                         size_t cmd_len, struct atsha204_buffer *rsp,
+                         enum atsha204_prio prio)
+{
+        u8 *to_send;
+        int rc;
+
+        /* Add command byte + length + 2 byte crc */
+        const int SEND_SIZE = ATSHA204_PACKET_LEN(cmd_len);
+
+        if ((rc = validate_write_size(cmd_len)))
+                return rc;
+
+        to_send = kmalloc(SEND_SIZE, GFP_KERNEL);
+        if (!to_send)
+                return -ENOMEM;
+
+        memcpy(&to_send[ATSHA204_CMD_OFFSET], cmd, cmd_len);
+
+        /* Held for reading so remove can wait out running commands */
+        down_read(&chip->remove_sem);
+
+        if (chip->dead){
+                rc = -ENODEV;
+                goto out;
+        }
+
+        /* Refuse what the bus can't carry before any traffic on it */
+        if (chip->transport->max_packet &&
+            SEND_SIZE > chip->transport->max_packet){
+                dev_dbg(chip->dev, "%s %s: %d\n", chip->transport->name,
+                        "can't carry a packet of", SEND_SIZE);
+                rc = -EMSGSIZE;
+                goto out;
+        }
+
+        if ((rc = atsha204_variant_check(READ_ONCE(chip->variant),
+                                         cmd, cmd_len))){
+                dev_dbg(chip->dev, "%s %s: 0x%02x\n",
+                        READ_ONCE(chip->variant)->name,
+                        "can't run opcode", cmd[0]);
+                goto out;
+        }
+
+        spin_lock(&chip->policy_lock);
+        rc = atsha204_policy_check(&chip->policy, cmd, cmd_len);
+        spin_unlock(&chip->policy_lock);
+
+        if (rc){
+                dev_dbg(chip->dev, "%s 0x%02x\n",
+                        "Config zone forbids opcode", cmd[0]);
+                goto out;
+        }
+
+        atsha204_frame_command(to_send, cmd_len);
+
+        rc = atsha204_i2c_transaction(chip, to_send, SEND_SIZE, rsp, prio);
+
+        if (SEND_SIZE == rc){
+                rc = 0;
+
+                if (atsha204_rsp_success(rsp)){
+                        if (atsha204_changes_config(cmd))
+                                atsha204_config_refresh(chip);
+                        else if (atsha204_changes_snapshot(cmd))
+                                atsha204_snapshot_refresh(chip);
+                }
+        }
+        else if (rc >= 0)
+                rc = -EIO;
+
+out:
+        up_read(&chip->remove_sem);
+        kfree(to_send);
+
+        return rc;
+}
+
+ssize_t atsha204_i2c_write(struct file *filep, const char __user *buf,
+                           size_t count, loff_t *f_pos)
+{
+        struct atsha204_file_priv *priv = filep->private_data;
+        u8 *cmd;
+        int rc;
+
+        if ((rc = validate_write_size(count)))
+                return rc;
+
+        cmd = memdup_user(buf, count);
+        if (IS_ERR(cmd))
+                return PTR_ERR(cmd);
+
+        /* Drop the response of the previous command */
+        kfree(priv->buf.ptr);
+        priv->buf.ptr = NULL;
+        priv->buf.len = 0;
+
+        /* Return to the user the number of bytes that the
+           user provided, don't include the extra header / crc
+           bytes */
+        if ((rc = atsha204_execute_cmd(priv->chip, cmd, count, &priv->buf,
+                                       priv->prio)) == 0)
+                rc = count;
+
+        /* Reset the f_pos, which indicates the read position in the
+           buffer. Byte 1 points at the start of the data */
+        *f_pos = 1;
+
+        kfree(cmd);
+
+        return rc;
+}
+
+ssize_t atsha204_i2c_read(struct file *filep, char __user *buf, size_t count,
+                          loff_t *f_pos)
+{
+        struct atsha204_file_priv *priv = filep->private_data;
+        struct atsha204_chip *chip = priv->chip;
+        struct atsha204_buffer *r_buf = &priv->buf;
+        ssize_t rc = 0;
+        /* r_buf has 3 extra bytes that should not be returned to the
+           user. The first byte (length) and the last two (crc).
+           However, since f_pos is reset to 1 on write, only subtract
+           2 here.
+        */
+        const int MAX_REC_LEN = r_buf->len - 2;
+
+        /* Check the CRC on the rec buffer on the first read */
+        if (*f_pos == 1 && !atsha204_check_rsp_crc16(r_buf->ptr, r_buf->len)){
+                rc = -EBADMSG;
+                dev_err(chip->dev, "%s\n", "CRC on received buffer failed.");
+                goto out;
+        }
+
+        if (*f_pos >= MAX_REC_LEN)
+                goto out;
+
+        if (*f_pos + count > MAX_REC_LEN)
+                count = MAX_REC_LEN - *f_pos;
+
+        if ((rc = copy_to_user(buf, &r_buf->ptr[*f_pos], count))){
+                rc = -EFAULT;
+        }
+        else{
+                *f_pos += count;
+                rc = count;
+        }
+
+out:
+        return rc;
+}
+
+
+/*
+ * Only one file at a time can send commands. Read-only opens can't
+ * write a command, so they don't take that slot: monitoring agents
+ * open the device O_RDONLY to map the snapshot alongside the command
+ * user.
+ */
+int atsha204_i2c_open(struct inode *inode, struct file *filep)
+{
+        struct miscdevice *misc = filep->private_data;
+        struct atsha204_chip *chip = container_of(misc, struct atsha204_chip,
+                                                  miscdev);
+        struct atsha204_file_priv *priv;
+        const bool exclusive = filep->f_mode & FMODE_WRITE;
+
+        if (exclusive && test_and_set_bit(0, &chip->is_open))
+                return -EBUSY;
+
+        priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+        if (NULL == priv){
+                if (exclusive)
+                        clear_bit(0, &chip->is_open);
+                return -ENOMEM;
+        }
+
+        /* The chip must outlive the file, which may be closed after
+           remove */
+        kref_get(&chip->kref);
+        priv->chip = chip;
+        priv->exclusive = exclusive;
+        priv->prio = ATSHA204_PRIO_INTERACTIVE;
+
+        filep->private_data = priv;
+
+        filep->f_pos = 0;
+
+        return 0;
+
+}
+
+
+static int atsha204_i2c_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+        struct atsha204_file_priv *priv = filep->private_data;
+
+        return atsha204_snapshot_mmap(priv->chip, vma);
+}
+
+long atsha204_i2c_ioctl(struct file *filep, unsigned int cmd,
+                        unsigned long arg)
+{
+        struct atsha204_file_priv *priv = filep->private_data;
+        u32 __user *argp = (u32 __user *)arg;
+        u32 prio;
+
+        switch (cmd){
+        case ATSHA204_IOC_SET_PRIO:
+                if (get_user(prio, argp))
+                        return -EFAULT;
+                if (prio >= ATSHA204_PRIO_COUNT)
+                        return -EINVAL;
+                priv->prio = prio;
+                return 0;
+        case ATSHA204_IOC_GET_PRIO:
+                return put_user((u32)priv->prio, argp);
+        default:
+                return -ENOTTY;
+        }
+}
+
+
+int atsha204_i2c_release(struct inode *inode, struct file *filep)
+{
+        struct atsha204_file_priv *priv = filep->private_data;
+        struct atsha204_chip *chip = priv->chip;
+
+        if (priv->exclusive)
+                clear_bit(0, &chip->is_open);
+
+        kfree(priv->buf.ptr);
+        kfree(priv);
+
+        kref_put(&chip->kref, atsha204_chip_release);
+
+        return 0;
+}
+
+
+
+
+struct atsha204_chip *atsha204_i2c_register_hardware(struct device *dev,
+                                                     struct i2c_client *client,
+                                                     const struct atsha204_transport *transport,
+                                                     const struct atsha204_variant *variant)
+{
+
+        struct atsha204_chip *chip;
+
+        if ((chip = kzalloc(sizeof(*chip), GFP_KERNEL)) == NULL)
+                goto out_null;
+
+        if ((chip->dev_num = ida_simple_get(&atsha204_ida, 0, 0,
+                                            GFP_KERNEL)) < 0)
+                goto out_free;
+
+        scnprintf(chip->devname, sizeof(chip->devname), "%s%d",
+                  "atsha", chip->dev_num);
+
+        kref_init(&chip->kref);
+        INIT_LIST_HEAD(&chip->node);
+        init_rwsem(&chip->remove_sem);
+
+        chip->dev = get_device(dev);
+        dev_set_drvdata(dev, chip);
+
+        chip->client = client;
+        chip->transport = transport;
+        chip->variant = variant;
+
+        atsha204_sched_init(chip);
+        spin_lock_init(&chip->policy_lock);
+        atsha204_rng_init(chip);
+
+        if (atsha204_snapshot_init(chip))
+                goto put_device;
+
+        INIT_DELAYED_WORK(&chip->verify_work, atsha204_i2c_verify_work);
+
+        if (atsha204_i2c_add_device(chip)){
+                dev_err(dev, "%s\n", "Failed to add device");
+                goto free_snapshot;
+        }
+
+
+        return chip;
+
+free_snapshot:
+        atsha204_snapshot_free(chip);
+put_device:
+        put_device(chip->dev);
+        ida_simple_remove(&atsha204_ida, chip->dev_num);
+out_free:
+        kfree(chip);
+out_null:
+        return NULL;
+}
+
+
+/*
+ * Runs off the probe path so that boot does not wait on the chip
+ * waking up. The hwrng is only registered once the chip has answered
+ * a Read with the serial number prefix every ATSHA204 carries.
+ */
+void atsha204_i2c_verify_work(struct work_struct *work)
+{
+        struct atsha204_chip *chip = container_of(to_delayed_work(work),
+                                                  struct atsha204_chip,
+                                                  verify_work);
+        /* SN[0:1] is fixed by Atmel */
+        const u8 SN_PREFIX[2] = {0x01, 0x23};
+        u8 sn[4];
+        bool unlocked;
+        int rc;
+
+        rc = atsha204_i2c_read4(chip, sn, 0, ATSHA204_ZONE_CONFIG);
+
+        if (sizeof(sn) != rc || memcmp(sn, SN_PREFIX, sizeof(SN_PREFIX))){
+                if (++chip->verify_tries < ATSHA204_VERIFY_TRIES){
+                        dev_dbg(chip->dev, "%s %d: %d\n",
+                                "Self-test failed, attempt",
+                                chip->verify_tries, rc);
+                        schedule_delayed_work(&chip->verify_work,
+                                msecs_to_jiffies(ATSHA204_VERIFY_BACKOFF_MS *
+                                                 chip->verify_tries));
+                }
+                else
+                        dev_err(chip->dev, "%s: 0x%x\n",
+                                "ATSHA204 device failed self-test",
+                                chip->client->addr);
+                return;
+        }
+
+        dev_dbg(chip->dev, "%s\n", "ATSHA204 passed self-test");
+
+        if ((rc = atsha204_detect_variant(chip)))
+                dev_warn(chip->dev, "%s %s: %d\n",
+                         "Can't identify the part, staying with",
+                         chip->variant->name, rc);
+
+        if ((rc = atsha204_config_refresh(chip)))
+                dev_warn(chip->dev, "%s: %d\n",
+                         "Can't load config zone, permission checks off "
+                         "or mmap snapshot incomplete", rc);
+
+        spin_lock(&chip->policy_lock);
+        unlocked = chip->policy.valid && !chip->policy.config_locked;
+        spin_unlock(&chip->policy_lock);
+
+        /* Until the config zone is locked Random answers with a fixed
+           pattern, which must not be passed off as entropy */
+        if (unlocked){
+                dev_warn(chip->dev, "%s\n",
+                         "Config zone unlocked, no hwrng or DRBG until "
+                         "the chip is locked and the driver rebound");
+                return;
+        }
+
+        atsha204_rng_add_device(chip);
+
+        atsha204_drbg_add_device(chip);
+}
+
+int atsha204_i2c_probe(struct i2c_client *client,
+                       const struct i2c_device_id *id)
+{
+        int result;
+        struct device *dev = &client->dev;
+        struct atsha204_chip *chip;
+        const struct atsha204_transport *transport;
+        /* The device name is only a hint until DevRev confirms it */
+        const struct atsha204_variant *variant =
+                &atsha204_variants[id->driver_data];
+
+        /* Plain I2C messages if the adapter has them, SMBus otherwise */
+        if ((transport = atsha204_transport_for(client)) == NULL)
+                return -ENODEV;
+
+        if ((chip = atsha204_i2c_register_hardware(dev, client, transport,
+                                                   variant)) == NULL)
+                return -ENODEV;
+
+        dev_dbg(dev, "%s %s\n", "Using transport", transport->name);
+
+        if ((result = atsha204_trace_add_device(chip)))
+                goto out_misc;
+
+        if ((result = atsha204_sysfs_add_device(chip))){
+                atsha204_trace_del_device(chip);
+                goto out_misc;
+        }
+
+        atsha204_api_add_device(chip);
+
+        /* Waking and testing the chip is left to the verify work */
+        schedule_delayed_work(&chip->verify_work, 0);
+
+        return 0;
+
+out_misc:
+        misc_deregister(&chip->miscdev);
+        kref_put(&chip->kref, atsha204_chip_release);
+        return result;
+}
+
+/*
+ * Called when the last reference is gone: the chip has been removed
+ * and no file or API handle points at it any more.
+ */
+void atsha204_chip_release(struct kref *kref)
+{
+        struct atsha204_chip *chip = container_of(kref, struct atsha204_chip,
+                                                  kref);
+
+        atsha204_drbg_free(chip);
+        atsha204_snapshot_free(chip);
+        put_device(chip->dev);
+        ida_simple_remove(&atsha204_ida, chip->dev_num);
+        kfree(chip);
+}
+
+int atsha204_i2c_remove(struct i2c_client *client)
+
+{
+        struct device *dev = &(client->dev);
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+
+        if (chip){
+                /* No new users, and wait for API commands in flight */
+                atsha204_api_del_device(chip);
+
+                cancel_delayed_work_sync(&chip->verify_work);
+                atsha204_drbg_del_device(chip);
+                atsha204_rng_del_device(chip);
+
+                misc_deregister(&chip->miscdev);
+                atsha204_sysfs_del_device(chip);
+                atsha204_trace_del_device(chip);
+
+                /* The device is in an idle state, where it keeps
+                 * ephemeral memory. Wakeup the device and sleep it,
+                 * which will cause it to clear its internal memory */
+
+                atsha204_i2c_wakeup(chip);
+                atsha204_i2c_sleep(chip);
+
+                kref_put(&chip->kref, atsha204_chip_release);
+        }
+
+        return 0;
+
+}
+
+
+
+
+
+static const struct i2c_device_id atsha204_i2c_id[] = {
+        {"atsha204-i2c", ATSHA204_VARIANT_SHA204},
+        {"atsha204a-i2c", ATSHA204_VARIANT_SHA204A},
+        {"atecc108-i2c", ATSHA204_VARIANT_ECC108A},
+        {"atecc508-i2c", ATSHA204_VARIANT_ECC508A},
+        {"atecc608-i2c", ATSHA204_VARIANT_ECC608A},
+        { }
+};
+MODULE_DEVICE_TABLE(i2c, atsha204_i2c_id);
+
+static struct i2c_driver atsha204_i2c_driver = {
+        .driver = {
+                .name = "atsha204-i2c",
+                .owner = THIS_MODULE,
+                .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        },
+        .probe = atsha204_i2c_probe,
+        .remove = atsha204_i2c_remove,
+        .id_table = atsha204_i2c_id,
+};
+
+static int __init atsha204_i2c_init(void)
+{
+        int rc;
+
+        atsha204_trace_init();
+
+        if ((rc = atsha204_api_init()))
+                goto out_trace;
+
+        if ((rc = i2c_add_driver(&atsha204_i2c_driver)))
+                goto out_api;
+
+        return 0;
+
+out_api:
+        atsha204_api_exit();
+out_trace:
+        atsha204_trace_exit();
+        return rc;
+}
+
+
+static void __exit atsha204_i2c_driver_cleanup(void)
+{
+        i2c_del_driver(&atsha204_i2c_driver);
+        atsha204_api_exit();
+        atsha204_trace_exit();
+}
+module_init(atsha204_i2c_init);
+module_exit(atsha204_i2c_driver_cleanup);
+
+static const struct file_operations atsha204_i2c_fops = {
+        .owner = THIS_MODULE,
+        .llseek = no_llseek,
+        .open = atsha204_i2c_open,
+        .read = atsha204_i2c_read,
+        .write = atsha204_i2c_write,
+        .unlocked_ioctl = atsha204_i2c_ioctl,
+        .compat_ioctl = compat_ptr_ioctl,
+        .mmap = atsha204_i2c_mmap,
+        .release = atsha204_i2c_release,
+};
+
+
+int atsha204_i2c_add_device(struct atsha204_chip *chip)
+{
+        int retval;
+
+        chip->miscdev.fops = &atsha204_i2c_fops;
+        chip->miscdev.minor = MISC_DYNAMIC_MINOR;
+
+        chip->miscdev.name = chip->devname;
+        chip->miscdev.parent = chip->dev;
+
+        if ((retval = misc_register(&chip->miscdev)) != 0){
+                chip->miscdev.name = NULL;
+                dev_err(chip->dev,
+                        "unable to misc_register %s, minor %d err=%d\n",
+                        chip->miscdev.name,
+                        chip->miscdev.minor,
+                        retval);
+        }
+
+
+        return retval;
+}
+
+int atsha204_i2c_read_cmd(struct atsha204_chip *chip, u8 *read_buf,
+                          const u16 addr, const u8 param1)
+{
+        u8 read_cmd[ATSHA204_PACKET_LEN(4)] = {0};
+        struct atsha204_buffer rsp, msg;
+        int rc, validate_status;
+        const int expected_len = (param1 & ATSHA204_READ_32) ?
+                ATSHA204_BLOCK_SIZE : ATSHA204_WORD_SIZE;
+
+        read_cmd[2] = 0x02; /* Read command opcode */
+        read_cmd[3] = param1;
+        read_cmd[4] = addr & 0xFF;
+        read_cmd[5] = addr >> 8;
+
+        atsha204_frame_command(read_cmd, 4);
+
+        rc = atsha204_i2c_transaction(chip, read_cmd,
+                                      sizeof(read_cmd), &rsp,
+                                      ATSHA204_PRIO_SYSFS);
+
+        if (sizeof(read_cmd) == rc){
+                if ((validate_status = atsha204_i2c_validate_rsp(&rsp, &msg))
+                    != 0)
+                        rc = validate_status;
+                else if (msg.len != expected_len)
+                        /* A single status byte means the chip refused
+                           the read */
+                        rc = -EIO;
+                else{
+                        memcpy(read_buf, msg.ptr, msg.len);
+                        rc = msg.len;
+                }
+
+                kfree(rsp.ptr);
+        }
+
+        return rc;
+}
+
+int atsha204_i2c_read4(struct atsha204_chip *chip, u8 *read_buf,
+                       const u16 addr, const u8 param1)
+{
+        return atsha204_i2c_read_cmd(chip, read_buf, addr,
+                                     param1 & ~ATSHA204_READ_32);
+}
+
+/* Fetch the 4 byte DevRev answer */
+int atsha204_i2c_devrev(struct atsha204_chip *chip, u8 *rev)
+{
+        u8 devrev_cmd[ATSHA204_PACKET_LEN(4)] = {0};
+        struct atsha204_buffer rsp, msg;
+        int rc;
+
+        devrev_cmd[ATSHA204_CMD_OFFSET] = ATSHA204_OP_DEVREV;
+
+        atsha204_frame_command(devrev_cmd, 4);
+
+        rc = atsha204_i2c_transaction(chip, devrev_cmd,
+                                      sizeof(devrev_cmd), &rsp,
+                                      ATSHA204_PRIO_SYSFS);
+
+        if (sizeof(devrev_cmd) == rc){
+                if ((rc = atsha204_i2c_validate_rsp(&rsp, &msg)) == 0){
+                        if (ATSHA204_WORD_SIZE == msg.len){
+                                memcpy(rev, msg.ptr, msg.len);
+                                rc = msg.len;
+                        }
+                        else
+                                rc = -EIO;
+                }
+
+                kfree(rsp.ptr);
+        }
+
+        return rc;
+}
+
+/*
+ * Ask the chip what it is and switch to that part's timing and
+ * command set. A revision this driver doesn't know keeps the profile
+ * named in the id table.
+ */
+int atsha204_detect_variant(struct atsha204_chip *chip)
+{
+        const struct atsha204_variant *variant;
+        u8 rev[ATSHA204_WORD_SIZE];
+        int rc;
+
+        if ((rc = atsha204_i2c_devrev(chip, rev)) != sizeof(rev))
+                return (rc < 0) ? rc : -EIO;
+
+        memcpy(chip->revision, rev, sizeof(rev));
+
+        if ((variant = atsha204_variant_from_rev(rev)) == NULL)
+                return -ENODEV;
+
+        if (variant != chip->variant)
+                dev_info(chip->dev, "%s %s, %s %s\n", "Found",
+                         variant->name, "configured as",
+                         chip->variant->name);
+
+        WRITE_ONCE(chip->variant, variant);
+
+        return 0;
+}
+
+/*
+ * Read count bytes starting at byte offset off of a config or OTP
+ * zone. Each 32 byte block that lies entirely inside the zone and is
+ * needed for more than one word is fetched with a single 32 byte
+ * Read, everything else with 4 byte Reads, so the chip sees the
+ * fewest commands that cover the range.
+ */
+ssize_t atsha204_i2c_read_zone(struct atsha204_chip *chip, const u8 zone,
+                               const size_t zone_size, u8 *buf,
+                               loff_t off, size_t count)
+{
+        const u16 WORDS_PER_BLOCK = ATSHA204_BLOCK_SIZE / ATSHA204_WORD_SIZE;
+        u8 chunk[ATSHA204_BLOCK_SIZE];
+        u16 word, last_word, block_start;
+        loff_t chunk_off, copy_start, copy_end;
+        size_t done = 0;
+        int rc;
+
+        if (off >= zone_size || 0 == count)
+                return 0;
+
+        if (off + count > zone_size)
+                count = zone_size - off;
+
+        word = off / ATSHA204_WORD_SIZE;
+        last_word = (off + count - 1) / ATSHA204_WORD_SIZE;
+
+        while (word <= last_word){
+                block_start = word - (word % WORDS_PER_BLOCK);
+
+                if (min_t(u16, block_start + WORDS_PER_BLOCK - 1, last_word)
+                    > word &&
+                    (block_start + WORDS_PER_BLOCK) * ATSHA204_WORD_SIZE
+                    <= zone_size){
+                        rc = atsha204_i2c_read_cmd(chip, chunk, block_start,
+                                                   zone | ATSHA204_READ_32);
+                        chunk_off = block_start * ATSHA204_WORD_SIZE;
+                        word = block_start + WORDS_PER_BLOCK;
+                }
+                else{
+                        rc = atsha204_i2c_read4(chip, chunk, word, zone);
+                        chunk_off = word * ATSHA204_WORD_SIZE;
+                        word++;
+                }
+
+                if (rc < 0)
+                        return done ? done : rc;
+
+                copy_start = max_t(loff_t, chunk_off, off);
+                copy_end = min_t(loff_t, chunk_off + rc, off + count);
+
+                memcpy(&buf[copy_start - off], &chunk[copy_start - chunk_off],
+                       copy_end - copy_start);
+                done += copy_end - copy_start;
+        }
+
+        return done;
+}
+
+
+static ssize_t configzone_show(struct device *dev,
+                               struct device_attribute *attr,
+                               char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+        int i;
+        u16 bytes, word_addr;
+        bool keep_going = true;
+        u8 param1 = 0; /* indicates configzone region */
+        char *str = buf;
+
+        u8 configzone[128] = {0};
+
+        for (bytes = 0; bytes < sizeof(configzone) && keep_going; bytes += 4){
+                word_addr = bytes / 4;
+                if (4 != atsha204_i2c_read4(chip,
+                                            &configzone[bytes],
+                                            word_addr, param1)){
+                        keep_going = false;
+                }
+        }
+
+        for (i = 0; i < bytes; i++) {
+                str += sprintf(str, "%02X ", configzone[i]);
+                if ((i + 1) % 4 == 0)
+                        str += sprintf(str, "\n");
+        }
+
+        return str - buf;
+}
+/*static DEVICE_ATTR_RO(configzone);*/
+struct device_attribute dev_attr_configzone = __ATTR_RO(configzone);
+
+static ssize_t serialnum_show(struct device *dev,
+                              struct device_attribute *attr,
+                              char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+        int i;
+        u16 bytes, word_addr;
+        bool keep_going = true;
+        u8 param1 = 0; /* indicates configzone region */
+        char *str = buf;
+
+        u8 serial[12] = {0};
+
+        for (bytes = 0; bytes < sizeof(serial) && keep_going; bytes += 4){
+                word_addr = bytes / 4;
+                if (4 != atsha204_i2c_read4(chip,
+                                            &serial[bytes],
+                                            word_addr, param1)){
+                        keep_going = false;
+                }
+        }
+
+        for (i = 0; i < bytes; i++) {
+                str += sprintf(str, "%02X", serial[i]);
+                if ((i + 1) % sizeof(serial) == 0)
+                        str += sprintf(str, "\n");
+        }
+
+        return str - buf;
+}
+/*static DEVICE_ATTR_RO(configzone);*/
+struct device_attribute dev_attr_serialnum = __ATTR_RO(serialnum);
+
+static ssize_t is_locked(struct device *dev,
+                         struct device_attribute *attr,
+                         char *buf,
+                         const int offset)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+        const u16 LOCK_ADDR = 0x15;
+        u8 param1 = 0; /* indicates configzone region */
+        char *str = buf;
+        u8 lock_buf[4];
+        const u8 UNLOCKED = 0x55;
+
+        if (sizeof(lock_buf) == atsha204_i2c_read4(chip,
+                                                   lock_buf,
+                                                   LOCK_ADDR, param1)){
+
+                if (UNLOCKED == lock_buf[offset])
+                        str += sprintf(str, "0");
+                else
+                        str += sprintf(str, "1");
+
+                str += sprintf(str, "\n");
+
+        }
+
+        return str - buf;
+}
+
+static ssize_t configlocked_show(struct device *dev,
+                                 struct device_attribute *attr,
+                                 char *buf)
+{
+        const int CONFIG_ZONE_LOCK_OFFSET = 3;
+
+        return is_locked(dev, attr, buf, CONFIG_ZONE_LOCK_OFFSET);
+}
+struct device_attribute dev_attr_configlocked = __ATTR_RO(configlocked);
+
+static ssize_t datalocked_show(struct device *dev,
+                               struct device_attribute *attr,
+                               char *buf)
+{
+        const int DATA_ZONE_LOCK_OFFSET = 2;
+
+        return is_locked(dev, attr, buf, DATA_ZONE_LOCK_OFFSET);
+}
+struct device_attribute dev_attr_datalocked = __ATTR_RO(datalocked);
+
+static ssize_t configzone_read(struct file *filp, struct kobject *kobj,
+                               struct bin_attribute *attr,
+                               char *buf, loff_t off, size_t count)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(kobj_to_dev(kobj));
+
+        /* Sized for the largest variant, reads stop at this part's */
+        return atsha204_i2c_read_zone(chip, ATSHA204_ZONE_CONFIG,
+                                      READ_ONCE(chip->variant)->config_size,
+                                      buf, off, count);
+}
+static struct bin_attribute bin_attr_configzone =
+        __BIN_ATTR_RO(configzone, ATSHA204_CONFIG_ZONE_MAX);
+
+static ssize_t otpzone_read(struct file *filp, struct kobject *kobj,
+                            struct bin_attribute *attr,
+                            char *buf, loff_t off, size_t count)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(kobj_to_dev(kobj));
+
+        return atsha204_i2c_read_zone(chip, ATSHA204_ZONE_OTP,
+                                      ATSHA204_OTP_ZONE_SIZE,
+                                      buf, off, count);
+}
+static struct bin_attribute bin_attr_otpzone =
+        __BIN_ATTR_RO(otpzone, ATSHA204_OTP_ZONE_SIZE);
+
+static ssize_t serialnum_read(struct file *filp, struct kobject *kobj,
+                              struct bin_attribute *attr,
+                              char *buf, loff_t off, size_t count)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(kobj_to_dev(kobj));
+        /* Serial byte i is config byte i for i < 4 and i + 4 after */
+        const int SN_SPLIT = 4;
+        const int SN_GAP = 4;
+        u8 config[ATSHA204_SERIAL_SIZE + 4];
+        loff_t first, last;
+        ssize_t rc;
+        int i;
+
+        if (off >= ATSHA204_SERIAL_SIZE || 0 == count)
+                return 0;
+
+        if (off + count > ATSHA204_SERIAL_SIZE)
+                count = ATSHA204_SERIAL_SIZE - off;
+
+        first = (off < SN_SPLIT) ? off : off + SN_GAP;
+        last = off + count - 1;
+        last = (last < SN_SPLIT) ? last : last + SN_GAP;
+
+        rc = atsha204_i2c_read_zone(chip, ATSHA204_ZONE_CONFIG,
+                                    ATSHA204_CONFIG_ZONE_SIZE,
+                                    &config[first], first, last - first + 1);
+        if (rc < 0)
+                return rc;
+        if (rc != last - first + 1)
+                return -EIO;
+
+        for (i = 0; i < count; i++){
+                int sn = off + i;
+                buf[i] = config[(sn < SN_SPLIT) ? sn : sn + SN_GAP];
+        }
+
+        return count;
+}
+static struct bin_attribute bin_attr_serialnum =
+        __BIN_ATTR_RO(serialnum, ATSHA204_SERIAL_SIZE);
+
+static ssize_t bus_busy_us_show(struct device *dev,
+                                struct device_attribute *attr,
+                                char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+
+        return sprintf(buf, "%llu\n", (unsigned long long)
+                       div_u64(atomic64_read(&chip->bus_busy_ns),
+                               NSEC_PER_USEC));
+}
+struct device_attribute dev_attr_bus_busy_us = __ATTR_RO(bus_busy_us);
+
+static ssize_t coalesced_show(struct device *dev,
+                              struct device_attribute *attr,
+                              char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+
+        return sprintf(buf, "%d\n", atomic_read(&chip->coalesced));
+}
+struct device_attribute dev_attr_coalesced = __ATTR_RO(coalesced);
+
+static ssize_t variant_show(struct device *dev,
+                            struct device_attribute *attr,
+                            char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+
+        return sprintf(buf, "%s %*phN\n", READ_ONCE(chip->variant)->name,
+                       (int)sizeof(chip->revision), chip->revision);
+}
+struct device_attribute dev_attr_variant = __ATTR_RO(variant);
+
+/* Recovery event counters; var is the step, or STEPS for the count of
+   exchanges that no step could save */
+static ssize_t recover_show(struct device *dev,
+                            struct device_attribute *attr,
+                            char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+        const int step = (long)container_of(attr, struct dev_ext_attribute,
+                                            attr)->var;
+
+        if (ATSHA204_RECOVER_STEPS == step)
+                return sprintf(buf, "%d\n",
+                               atomic_read(&chip->recovery_failed));
+
+        return sprintf(buf, "%d\n", atomic_read(&chip->recoveries[step]));
+}
+
+#define ATSHA204_RECOVER_ATTR(name, step)                               \
+        static struct dev_ext_attribute dev_attr_recover_##name = {     \
+                __ATTR(recover_##name, S_IRUGO, recover_show, NULL),    \
+                (void *)step                                            \
+        }
+
+ATSHA204_RECOVER_ATTR(rewake, ATSHA204_RECOVER_REWAKE);
+ATSHA204_RECOVER_ATTR(reset, ATSHA204_RECOVER_RESET);
+ATSHA204_RECOVER_ATTR(bus, ATSHA204_RECOVER_BUS);
+ATSHA204_RECOVER_ATTR(failed, ATSHA204_RECOVER_STEPS);
+
+static struct attribute *atsha204_dev_attrs[] = {
+        &dev_attr_configzone.attr,
+        &dev_attr_serialnum.attr,
+        &dev_attr_configlocked.attr,
+        &dev_attr_datalocked.attr,
+        &dev_attr_bus_busy_us.attr,
+        &dev_attr_coalesced.attr,
+        &dev_attr_variant.attr,
+        &dev_attr_rng_rate.attr,
+        &dev_attr_recover_rewake.attr.attr,
+        &dev_attr_recover_reset.attr.attr,
+        &dev_attr_recover_bus.attr.attr,
+        &dev_attr_recover_failed.attr.attr,
+        NULL,
+};
+
+static const struct attribute_group atsha204_dev_group = {
+        .attrs = atsha204_dev_attrs,
+};
+
+static ssize_t slot_show(struct device *dev,
+                         struct device_attribute *attr,
+                         char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+        const int i = (long)container_of(attr, struct dev_ext_attribute,
+                                         attr)->var;
+        struct atsha204_slot_policy slot;
+        bool valid;
+
+        spin_lock(&chip->policy_lock);
+        valid = chip->policy.checked;
+        slot = chip->policy.slots[i];
+        spin_unlock(&chip->policy_lock);
+
+        if (!valid)
+                return -ENODATA;
+
+        return sprintf(buf, "config=0x%04x read_key=%u write_key=%u "
+                       "write_config=0x%x secret=%d encrypt_read=%d "
+                       "check_only=%d single_use=%d\n",
+                       slot.slot_config, slot.read_key, slot.write_key,
+                       slot.write_config, slot.is_secret, slot.encrypt_read,
+                       slot.check_only, slot.single_use);
+}
+
+#define ATSHA204_SLOT_ATTR(n)                                           \
+        static struct dev_ext_attribute dev_attr_slot##n = {            \
+                __ATTR(slot##n, S_IRUGO, slot_show, NULL), (void *)n    \
+        }
+
+ATSHA204_SLOT_ATTR(0);
+ATSHA204_SLOT_ATTR(1);
+ATSHA204_SLOT_ATTR(2);
+ATSHA204_SLOT_ATTR(3);
+ATSHA204_SLOT_ATTR(4);
+ATSHA204_SLOT_ATTR(5);
+ATSHA204_SLOT_ATTR(6);
+ATSHA204_SLOT_ATTR(7);
+ATSHA204_SLOT_ATTR(8);
+ATSHA204_SLOT_ATTR(9);
+ATSHA204_SLOT_ATTR(10);
+ATSHA204_SLOT_ATTR(11);
+ATSHA204_SLOT_ATTR(12);
+ATSHA204_SLOT_ATTR(13);
+ATSHA204_SLOT_ATTR(14);
+ATSHA204_SLOT_ATTR(15);
+
+/* Decoded SlotConfig, one file per slot */
+static struct attribute *atsha204_slot_attrs[] = {
+        &dev_attr_slot0.attr.attr,
+        &dev_attr_slot1.attr.attr,
+        &dev_attr_slot2.attr.attr,
+        &dev_attr_slot3.attr.attr,
+        &dev_attr_slot4.attr.attr,
+        &dev_attr_slot5.attr.attr,
+        &dev_attr_slot6.attr.attr,
+        &dev_attr_slot7.attr.attr,
+        &dev_attr_slot8.attr.attr,
+        &dev_attr_slot9.attr.attr,
+        &dev_attr_slot10.attr.attr,
+        &dev_attr_slot11.attr.attr,
+        &dev_attr_slot12.attr.attr,
+        &dev_attr_slot13.attr.attr,
+        &dev_attr_slot14.attr.attr,
+        &dev_attr_slot15.attr.attr,
+        NULL,
+};
+
+static const struct attribute_group atsha204_slot_group = {
+        .name = "slots",
+        .attrs = atsha204_slot_attrs,
+};
+
+/* Raw zone contents for programs, read with offset and length so
+   only the words actually requested are fetched from the chip */
+static struct bin_attribute *atsha204_raw_attrs[] = {
+        &bin_attr_configzone,
+        &bin_attr_otpzone,
+        &bin_attr_serialnum,
+        NULL,
+};
+
+static const struct attribute_group atsha204_raw_group = {
+        .name = "raw",
+        .bin_attrs = atsha204_raw_attrs,
+};
+
+int atsha204_sysfs_add_device(struct atsha204_chip *chip)
+{
+        int err;
+        err = sysfs_create_group(&chip->dev->kobj,
+                                 &atsha204_dev_group);
+
+        if (err){
+                dev_err(chip->dev,
+                        "failed to create sysfs attributes, %d\n", err);
+                return err;
+        }
+
+        err = sysfs_create_group(&chip->dev->kobj,
+                                 &atsha204_raw_group);
+
+        if (err){
+                dev_err(chip->dev,
+                        "failed to create raw sysfs attributes, %d\n", err);
+                sysfs_remove_group(&chip->dev->kobj, &atsha204_dev_group);
+                return err;
+        }
+
+        err = sysfs_create_group(&chip->dev->kobj,
+                                 &atsha204_slot_group);
+
+        if (err){
+                dev_err(chip->dev,
+                        "failed to create slot sysfs attributes, %d\n", err);
+                sysfs_remove_group(&chip->dev->kobj, &atsha204_raw_group);
+                sysfs_remove_group(&chip->dev->kobj, &atsha204_dev_group);
+        }
+
+        return err;
+}
+
+void atsha204_sysfs_del_device(struct atsha204_chip *chip)
+{
+        sysfs_remove_group(&chip->dev->kobj, &atsha204_slot_group);
+        sysfs_remove_group(&chip->dev->kobj, &atsha204_raw_group);
+        sysfs_remove_group(&chip->dev->kobj, &atsha204_dev_group);
+}
+
+MODULE_AUTHOR("Josh Datko <jbd@cryptotronix.com");
+MODULE_DESCRIPTION("Atmel ATSHA204 driver");
+MODULE_VERSION(ATSHA204_I2C_VERSION);
+MODULE_LICENSE("GPL");
@@ -0,0 +1,328 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * KUnit tests of the ATSHA204 transaction engine
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Runs atsha204_i2c_transaction() against the mock transport, so the
+ * wake, polling, recovery and validation paths can be driven without
+ * a chip. Each case logs how long its path took.
+ */
+#include <kunit/test.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include "atsha204-i2c.h"
+
+struct atsha204_test {
+        struct atsha204_chip chip;
+        struct atsha204_mock mock;
+        struct atsha204_buffer rsp;
+};
+
+static const u8 random_cmd[] = {ATSHA204_OP_RANDOM, 0x00, 0x00, 0x00};
+static const u8 devrev_cmd[] = {ATSHA204_OP_DEVREV, 0x00, 0x00, 0x00};
+static const u8 update_cmd[] = {ATSHA204_OP_UPDATEEXTRA, 0x00, 0x00, 0x00};
+static const u8 gendig_cmd[] = {ATSHA204_OP_GENDIG, 0x02, 0x00, 0x00};
+
+/* All the commands above frame to this */
+static const int PACKET_LEN = ATSHA204_PACKET_LEN(4);
+
+static int atsha204_test_init(struct kunit *test)
+{
+        struct atsha204_test *t;
+
+        t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t);
+
+        atsha204_sched_init(&t->chip);
+        t->chip.transport = &atsha204_mock_transport;
+        t->chip.transport_priv = &t->mock;
+        t->chip.variant = &atsha204_variants[ATSHA204_VARIANT_SHA204];
+
+        test->priv = t;
+
+        return 0;
+}
+
+static void atsha204_test_exit(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        kfree(t->rsp.ptr);
+}
+
+/* Frame cmd, run it and log the time taken under label */
+static int atsha204_test_run(struct kunit *test, const char *label,
+                             const u8 *cmd, size_t len)
+{
+        struct atsha204_test *t = test->priv;
+        u8 packet[ATSHA204_PACKET_LEN(4)];
+        ktime_t start;
+        int rc;
+
+        memcpy(&packet[ATSHA204_CMD_OFFSET], cmd, len);
+        atsha204_frame_command(packet, len);
+
+        start = ktime_get();
+        rc = atsha204_i2c_transaction(&t->chip, packet, sizeof(packet),
+                                      &t->rsp, ATSHA204_PRIO_KERNEL);
+        kunit_info(test, "%s: %lld us, rc %d\n", label,
+                   ktime_us_delta(ktime_get(), start), rc);
+
+        if (rc == sizeof(packet))
+                KUNIT_EXPECT_EQ(test, 0, memcmp(t->mock.cmd, packet,
+                                                sizeof(packet)));
+
+        return rc;
+}
+
+static void atsha204_test_random(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+        struct atsha204_buffer msg;
+        u8 data[ATSHA204_BLOCK_SIZE];
+        int i;
+
+        for (i = 0; i < sizeof(data); i++)
+                data[i] = i;
+
+        atsha204_mock_set_rsp(&t->mock, data, sizeof(data));
+
+        KUNIT_ASSERT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "random", random_cmd,
+                                          sizeof(random_cmd)));
+
+        KUNIT_ASSERT_EQ(test, 0, atsha204_i2c_validate_rsp(&t->rsp, &msg));
+        KUNIT_EXPECT_EQ(test, (int)sizeof(data), msg.len);
+        KUNIT_EXPECT_EQ(test, 0, memcmp(msg.ptr, data, sizeof(data)));
+
+        /* One wake, command and idle; one status read and the rest */
+        KUNIT_EXPECT_EQ(test, 1U, t->mock.wakes);
+        KUNIT_EXPECT_EQ(test, 2U, t->mock.sends);
+        KUNIT_EXPECT_EQ(test, 1U, t->mock.idles);
+        KUNIT_EXPECT_EQ(test, 3U, t->mock.recvs);
+}
+
+static void atsha204_test_status_only(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        KUNIT_ASSERT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "status", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+
+        /* A bare status packet needs no second read */
+        KUNIT_EXPECT_EQ(test, ATSHA204_RSP_MIN_LEN, t->rsp.len);
+        KUNIT_EXPECT_EQ(test, 2U, t->mock.recvs);
+}
+
+static void atsha204_test_wake_retry(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.wake_nacks = 3;
+
+        KUNIT_EXPECT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "wake retry", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+        KUNIT_EXPECT_EQ(test, 4U, t->mock.wakes);
+}
+
+/* An ACKed wake pulse is not enough, the token has to be read too */
+static void atsha204_test_wake_token(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.lost_tokens = 2;
+
+        KUNIT_EXPECT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "lost token", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+        KUNIT_EXPECT_EQ(test, 3U, t->mock.wakes);
+}
+
+static void atsha204_test_wake_fail(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.wake_nacks = UINT_MAX;
+
+        KUNIT_EXPECT_EQ(test, -ENODEV,
+                        atsha204_test_run(test, "no chip", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(&t->chip.recovery_failed));
+
+        /* Nothing on the bus to clock free */
+        KUNIT_EXPECT_EQ(test, 0U, t->mock.recovers);
+}
+
+static void atsha204_test_poll_busy(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.busy_polls = 5;
+
+        KUNIT_EXPECT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "poll 5 NACKs", random_cmd,
+                                          sizeof(random_cmd)));
+        KUNIT_EXPECT_EQ(test, 1U + 5U + 1U, t->mock.recvs);
+}
+
+static void atsha204_test_poll_timeout(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+        int step;
+
+        t->mock.busy_polls = UINT_MAX;
+
+        KUNIT_EXPECT_EQ(test, -ETIMEDOUT,
+                        atsha204_test_run(test, "poll timeout", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+
+        /* Every recovery step ran once, then the command gave up */
+        for (step = 0; step < ATSHA204_RECOVER_STEPS; step++)
+                KUNIT_EXPECT_EQ(test, 1,
+                                atomic_read(&t->chip.recoveries[step]));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(&t->chip.recovery_failed));
+        KUNIT_EXPECT_EQ(test, 1U, t->mock.recovers);
+        KUNIT_EXPECT_EQ(test, 1U, t->mock.sleeps);
+}
+
+/* The chip may have run the command, so it must not run again */
+static void atsha204_test_no_replay(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+        int step;
+
+        t->mock.busy_polls = UINT_MAX;
+
+        KUNIT_EXPECT_EQ(test, -ETIMEDOUT,
+                        atsha204_test_run(test, "no replay", update_cmd,
+                                          sizeof(update_cmd)));
+
+        /* The command and the idle after the timeout */
+        KUNIT_EXPECT_EQ(test, 2U, t->mock.sends);
+        for (step = 0; step < ATSHA204_RECOVER_STEPS; step++)
+                KUNIT_EXPECT_EQ(test,
+                                (ATSHA204_RECOVER_REWAKE == step) ? 1 : 0,
+                                atomic_read(&t->chip.recoveries[step]));
+        KUNIT_EXPECT_EQ(test, 0, atomic_read(&t->chip.recovery_failed));
+}
+
+/* A command that never reached the chip is safe to send again */
+static void atsha204_test_replay_unsent(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.wake_nacks = ATSHA204_WAKE_TRIES;
+
+        KUNIT_EXPECT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "replay unsent", update_cmd,
+                                          sizeof(update_cmd)));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(
+                                &t->chip.recoveries[ATSHA204_RECOVER_REWAKE]));
+}
+
+/* A sleep/wake cycle would clear the TempKey GenDig works on */
+static void atsha204_test_keep_tempkey(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.wake_nacks = 2 * ATSHA204_WAKE_TRIES;
+
+        KUNIT_EXPECT_EQ(test, -ENODEV,
+                        atsha204_test_run(test, "keep tempkey", gendig_cmd,
+                                          sizeof(gendig_cmd)));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(
+                                &t->chip.recoveries[ATSHA204_RECOVER_REWAKE]));
+        KUNIT_EXPECT_EQ(test, 0, atomic_read(
+                                &t->chip.recoveries[ATSHA204_RECOVER_RESET]));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(&t->chip.recovery_failed));
+}
+
+/* 12 polls of 4 ms fit in the ATSHA204's 50 ms Random but not in the
+   ATECC508A's 23 ms */
+static void atsha204_test_variant_budget(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.busy_polls = 12;
+
+        KUNIT_EXPECT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "ATSHA204 budget",
+                                          random_cmd, sizeof(random_cmd)));
+
+        t->chip.variant = &atsha204_variants[ATSHA204_VARIANT_ECC508A];
+
+        KUNIT_EXPECT_EQ(test, -ETIMEDOUT,
+                        atsha204_test_run(test, "ATECC508A budget",
+                                          random_cmd, sizeof(random_cmd)));
+}
+
+static void atsha204_test_bus_fault(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.bus_faults = 1;
+        t->mock.fault_error = -EAGAIN;
+
+        KUNIT_EXPECT_EQ(test, PACKET_LEN,
+                        atsha204_test_run(test, "bus fault", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(
+                                &t->chip.recoveries[ATSHA204_RECOVER_REWAKE]));
+        KUNIT_EXPECT_EQ(test, 0, atomic_read(&t->chip.recovery_failed));
+}
+
+static void atsha204_test_bad_crc(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.corrupt_rsp = true;
+
+        KUNIT_EXPECT_EQ(test, -EBADMSG,
+                        atsha204_test_run(test, "bad crc", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+        KUNIT_EXPECT_EQ(test, 1, atomic_read(&t->chip.recovery_failed));
+}
+
+static void atsha204_test_bad_length(struct kunit *test)
+{
+        struct atsha204_test *t = test->priv;
+
+        t->mock.rsp_len = ATSHA204_RSP_MIN_LEN;
+        t->mock.rsp[0] = ATSHA204_RSP_MAX_LEN + 1;
+
+        KUNIT_EXPECT_EQ(test, -EBADMSG,
+                        atsha204_test_run(test, "bad length", devrev_cmd,
+                                          sizeof(devrev_cmd)));
+}
+
+static struct kunit_case atsha204_test_cases[] = {
+        KUNIT_CASE(atsha204_test_random),
+        KUNIT_CASE(atsha204_test_status_only),
+        KUNIT_CASE(atsha204_test_wake_retry),
+        KUNIT_CASE(atsha204_test_wake_token),
+        KUNIT_CASE(atsha204_test_wake_fail),
+        KUNIT_CASE(atsha204_test_poll_busy),
+        KUNIT_CASE(atsha204_test_poll_timeout),
+        KUNIT_CASE(atsha204_test_no_replay),
+        KUNIT_CASE(atsha204_test_replay_unsent),
+        KUNIT_CASE(atsha204_test_keep_tempkey),
+        KUNIT_CASE(atsha204_test_variant_budget),
+        KUNIT_CASE(atsha204_test_bus_fault),
+        KUNIT_CASE(atsha204_test_bad_crc),
+        KUNIT_CASE(atsha204_test_bad_length),
+        {}
+};
+
+static struct kunit_suite atsha204_test_suite = {
+        .name = "atsha204",
+        .init = atsha204_test_init,
+        .exit = atsha204_test_exit,
+        .test_cases = atsha204_test_cases,
+};
+kunit_test_suite(atsha204_test_suite);
@@ -16,21 +16,219 @@
 #include <linux/device.h>
 #include <linux/hw_random.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/list.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/rwsem.h>
+#include <crypto/rng.h>
+#include "atsha204-proto.h"
+#include "atsha204-uapi.h"
+#include "atsha204-api.h"
 
 #define ATSHA204_I2C_VERSION "0.1"
-#define ATSHA204_SLEEP 0x01
 #define ATSHA204_RNG_NAME "atsha-rng"
 
+/* Self-test attempts made after probe before giving up on the chip,
+   the delay between them grows by the backoff each time */
+#define ATSHA204_VERIFY_TRIES 5
+#define ATSHA204_VERIFY_BACKOFF_MS 100
+
+/* Wake attempts are spaced by tWHI, the time the chip needs after a
+   wake pulse before it answers. tWHI itself comes from the variant */
+#define ATSHA204_WAKE_TRIES 10
+/* Slack on top of the opcode's max execution time before polling
+   gives up */
+#define ATSHA204_POLL_MARGIN_MS 10
+
+/* Escalating steps taken when an exchange with the chip fails, see
+   atsha204_i2c_recover() */
+enum atsha204_recovery {
+    ATSHA204_RECOVER_REWAKE = 0,
+    ATSHA204_RECOVER_RESET,
+    ATSHA204_RECOVER_BUS,
+    ATSHA204_RECOVER_STEPS,
+};
+
+/* Read command param1: zone select and 32 byte read flag */
+#define ATSHA204_ZONE_CONFIG 0x00
+#define ATSHA204_ZONE_OTP 0x01
+#define ATSHA204_ZONE_DATA 0x02
+#define ATSHA204_READ_32 0x80
+
+#define ATSHA204_WORD_SIZE 4
+#define ATSHA204_BLOCK_SIZE 32
+#define ATSHA204_CONFIG_ZONE_SIZE 88
+/* The ATECC config zone, the largest of any variant */
+#define ATSHA204_CONFIG_ZONE_MAX 128
+#define ATSHA204_OTP_ZONE_SIZE 64
+/* SN[0:3] lives in config bytes 0-3 and SN[4:8] in config bytes 8-12 */
+#define ATSHA204_SERIAL_SIZE 9
+
+struct atsha204_chip;
+
+/*
+ * How the transaction engine reaches the chip, atsha204-transport.c.
+ * send and recv return the byte count or a negative errno; a busy
+ * chip NACKs, which shows up as -ENXIO, -EREMOTEIO or -EIO. wake
+ * returns 0 once the chip has acknowledged the wake pulse. lock and
+ * unlock keep other masters off the bus in bus sharing mode.
+ */
+struct atsha204_transport {
+    const char *name;
+    size_t max_packet;          /* longest send(), word address included;
+                                   0 if there is no limit */
+    int (*send)(struct atsha204_chip *chip, const u8 *buf, int len);
+    int (*recv)(struct atsha204_chip *chip, u8 *buf, int len);
+    int (*wake)(struct atsha204_chip *chip);
+    void (*lock)(struct atsha204_chip *chip);
+    void (*unlock)(struct atsha204_chip *chip);
+    int (*recover)(struct atsha204_chip *chip);
+};
+
+/* State of the mock transport, atsha204-mock.c */
+struct atsha204_mock {
+    /* Programmed by the test */
+    unsigned int wake_nacks;    /* wake pulses ignored before waking */
+    unsigned int lost_tokens;   /* wakes ACKed whose token can't be read */
+    unsigned int busy_polls;    /* reads NACKed after each command */
+    unsigned int bus_faults;    /* commands whose first poll fails... */
+    int fault_error;            /* ...with this error */
+    bool corrupt_rsp;
+    unsigned int delay_us;      /* bus time per transfer */
+    u8 rsp[ATSHA204_RSP_MAX_LEN];
+    size_t rsp_len;             /* 0 answers with a success status */
+
+    /* Seen by the mock */
+    u8 cmd[ATSHA204_PACKET_LEN(ATSHA204_RSP_MAX_LEN)];
+    size_t cmd_len;
+    unsigned int wakes, sends, recvs, idles, sleeps, recovers;
+
+    /* The chip */
+    bool awake;
+    bool pending;
+    unsigned int nacks_left;
+    u8 out[ATSHA204_RSP_MAX_LEN];
+    size_t out_len, out_pos;
+};
+
+/* A request waiting for its turn on the chip */
+struct atsha204_waiter {
+    struct list_head node;
+    struct completion granted;
+    unsigned long since;
+    /* Both under sched_lock, a follower may raise prio */
+    enum atsha204_prio prio;
+    bool queued;
+};
+
+/* An idempotent command in flight, see atsha204_i2c_transaction() */
+struct atsha204_flight {
+    struct list_head node;
+    const u8 *packet;
+    size_t len;
+    struct list_head followers;
+    /* The leader's place in the scheduler queue */
+    struct atsha204_waiter *waiter;
+};
+
+/* A request riding on an identical one already in flight */
+struct atsha204_follower {
+    struct list_head node;
+    struct completion done;
+    int rc;
+    struct atsha204_buffer rsp;
+};
+
 struct atsha204_chip {
     struct device *dev;
 
     int dev_num;
-    char devname[7];
+    char devname[16];
     unsigned long is_open;
 
+    /* Lifetime, see atsha204_chip_release(). Held by the chip list,
+       open files and in-kernel API handles */
+    struct kref kref;
+    struct list_head node;
+    struct rw_semaphore remove_sem;
+    bool dead;
+
     struct i2c_client *client;
     struct miscdevice miscdev;
-    struct mutex transaction_mutex;
+
+    const struct atsha204_transport *transport;
+    void *transport_priv;
+
+    /* Timing and command set of the part, picked from the id table at
+       probe and from DevRev once the chip answers. Read with
+       READ_ONCE, it can change under a running command */
+    const struct atsha204_variant *variant;
+    u8 revision[4];
+
+    /* Transaction scheduler, see atsha204_sched_acquire() */
+    spinlock_t sched_lock;
+    struct list_head sched_queue[ATSHA204_PRIO_COUNT];
+    bool sched_busy;
+
+    /* Idempotent commands in flight, and requests merged into them */
+    spinlock_t flight_lock;
+    struct list_head flights;
+    atomic_t coalesced;
+
+    struct delayed_work verify_work;
+    int verify_tries;
+
+    /* Bus sharing mode, see atsha204_i2c_bus_get() */
+    bool bus_share;
+    bool bus_locked;
+    ktime_t bus_since;
+    atomic64_t bus_busy_ns;
+
+    /* Recovery events per step, and exchanges that failed them all */
+    atomic_t recoveries[ATSHA204_RECOVER_STEPS];
+    atomic_t recovery_failed;
+
+    /* What the config zone allows, refreshed on Lock */
+    spinlock_t policy_lock;
+    struct atsha204_policy policy;
+
+    /* Transaction trace, atsha204-trace.c */
+    bool trace_enabled;
+    spinlock_t trace_lock;
+    DECLARE_KFIFO_PTR(trace_fifo, struct atsha204_trace_rec);
+    struct dentry *debugfs;
+
+    /* Page mapped by mmap() of the misc device, atsha204-snapshot.c */
+    struct atsha204_snapshot *snapshot;
+    struct mutex snapshot_lock;
+
+    /* hwrng front end and its Random budget, atsha204-rng.c */
+    char rng_name[16];
+    struct hwrng rng;
+    bool rng_registered;
+    struct mutex rng_lock;
+    unsigned int rng_rate;
+    u64 rng_tat;
+    u8 rng_pool[ATSHA204_BLOCK_SIZE];
+    int rng_pool_len;
+    struct work_struct rng_refill_work;
+
+    /* Chip seeded DRBG endpoint */
+    char drbg_name[16];
+    struct miscdevice drbg_miscdev;
+    bool drbg_registered;
+    bool drbg_dead;
+    struct crypto_rng *drbg;
+    struct mutex drbg_lock;
+    u8 *drbg_buf;
+    u64 drbg_bytes;
+    unsigned long drbg_seeded_at;
+    struct work_struct drbg_reseed_work;
 };
 
 struct atsha204_cmd_metadata {
@@ -39,79 +237,125 @@ struct atsha204_cmd_metadata {
     unsigned long usleep;
 };
 
-struct atsha204_buffer {
-    u8 *ptr;
-    int len;
-};
-
 struct atsha204_file_priv {
     struct atsha204_chip *chip;
+    /* Holds the single command slot, see atsha204_i2c_open() */
+    bool exclusive;
+    enum atsha204_prio prio;
     struct atsha204_cmd_metadata meta;
 
     struct atsha204_buffer buf;
 };
 
-static const struct i2c_device_id atsha204_i2c_id[] = {
-    {"atsha204-i2c", 0},
-    { }
-};
-
-
 /* I2C detection */
 int atsha204_i2c_probe(struct i2c_client *client,
                            const struct i2c_device_id *id);
 
 int atsha204_i2c_remove(struct i2c_client *client);
+void atsha204_i2c_verify_work(struct work_struct *work);
 
 /* Device registration */
 struct atsha204_chip *atsha204_i2c_register_hardware(struct device *dev,
-                                                     struct i2c_client *client);
+                                                     struct i2c_client *client,
+                                                     const struct atsha204_transport *transport,
+                                                     const struct atsha204_variant *variant);
 int atsha204_i2c_add_device(struct atsha204_chip *chip);
 void atsha204_i2c_del_device(struct atsha204_chip *chip);
 int atsha204_i2c_release(struct inode *inode, struct file *filep);
 int atsha204_i2c_open(struct inode *inode, struct file *filep);
+long atsha204_i2c_ioctl(struct file *filep, unsigned int cmd,
+                        unsigned long arg);
+
+/* Zone access */
+int atsha204_i2c_read_cmd(struct atsha204_chip *chip, u8 *read_buf,
+                          const u16 addr, const u8 param1);
+int atsha204_i2c_devrev(struct atsha204_chip *chip, u8 *rev);
+int atsha204_detect_variant(struct atsha204_chip *chip);
+int atsha204_i2c_read4(struct atsha204_chip *chip, u8 *read_buf,
+                       const u16 addr, const u8 param1);
+ssize_t atsha204_i2c_read_zone(struct atsha204_chip *chip, const u8 zone,
+                               const size_t zone_size, u8 *buf,
+                               loff_t off, size_t count);
 
-/* atsha204 crc functions */
-u16 atsha204_crc16(const u8 *buf, const u8 len);
-bool atsha204_check_rsp_crc16(const u8 *buf, const u8 len);
-int atsha204_i2c_validate_rsp(const struct atsha204_buffer *packet,
-                                  struct atsha204_buffer *rsp);
-void atsha204_i2c_crc_command(u8 *cmd, int len);
+int atsha204_config_refresh(struct atsha204_chip *chip);
 
 /* sysfs functions */
 int atsha204_sysfs_add_device(struct atsha204_chip *chip);
 void atsha204_sysfs_del_device(struct atsha204_chip *chip);
 
 /* atsha204 specific functions */
-int atsha204_i2c_wakeup(const struct i2c_client *client);
-int atsha204_i2c_idle(const struct i2c_client *client);
+int atsha204_i2c_send(struct atsha204_chip *chip, const u8 *buf, int len);
+int atsha204_i2c_recv(struct atsha204_chip *chip, u8 *buf, int len);
+int atsha204_i2c_wakeup(struct atsha204_chip *chip);
+int atsha204_i2c_idle(struct atsha204_chip *chip);
+int atsha204_i2c_sleep(struct atsha204_chip *chip);
 int atsha204_i2c_transmit(const struct i2c_client *client,
                           const char __user *buf, size_t len);
+void atsha204_sched_init(struct atsha204_chip *chip);
+void atsha204_sched_acquire(struct atsha204_chip *chip,
+                            enum atsha204_prio prio);
+void atsha204_sched_release(struct atsha204_chip *chip);
 int atsha204_i2c_transaction(struct atsha204_chip *chip,
                              const u8* to_send, size_t to_send_len,
-                             struct atsha204_buffer *buf);
-int atsha204_i2c_get_random(u8 *to_fill, const size_t max);
+                             struct atsha204_buffer *buf,
+                             enum atsha204_prio prio);
+int atsha204_i2c_random(struct atsha204_chip *chip, u8 *to_fill,
+                        const size_t max, enum atsha204_prio prio);
+int atsha204_execute_cmd(struct atsha204_chip *chip, const u8 *cmd,
+                         size_t cmd_len, struct atsha204_buffer *rsp,
+                         enum atsha204_prio prio);
+void atsha204_chip_release(struct kref *kref);
 
-void atsha204_set_params(struct atsha204_cmd_metadata *cmd,
-                         int expected_rec_len,
-                         unsigned long usleep)
+/* Chip list and in-kernel API, atsha204-api.c */
+int atsha204_api_init(void);
+void atsha204_api_exit(void);
+void atsha204_api_add_device(struct atsha204_chip *chip);
+void atsha204_api_del_device(struct atsha204_chip *chip);
+
+/* Bus backends, atsha204-transport.c */
+extern const struct atsha204_transport atsha204_raw_transport;
+extern const struct atsha204_transport atsha204_smbus_transport;
+const struct atsha204_transport *
+atsha204_transport_for(const struct i2c_client *client);
+
+/* Mock backend for the KUnit tests, atsha204-mock.c */
+extern const struct atsha204_transport atsha204_mock_transport;
+void atsha204_mock_set_rsp(struct atsha204_mock *mock, const u8 *data,
+                           size_t len);
+
+/* Transaction trace, atsha204-trace.c */
+void atsha204_trace_init(void);
+void atsha204_trace_exit(void);
+int atsha204_trace_add_device(struct atsha204_chip *chip);
+void atsha204_trace_del_device(struct atsha204_chip *chip);
+void atsha204_trace_record(struct atsha204_chip *chip,
+                           const struct atsha204_trace_rec *rec);
+
+/* Identity and zone snapshot, atsha204-snapshot.c */
+int atsha204_snapshot_init(struct atsha204_chip *chip);
+void atsha204_snapshot_free(struct atsha204_chip *chip);
+int atsha204_snapshot_update(struct atsha204_chip *chip, const u8 *config);
+int atsha204_snapshot_refresh(struct atsha204_chip *chip);
+int atsha204_snapshot_mmap(struct atsha204_chip *chip,
+                           struct vm_area_struct *vma);
+
+/* hwrng front end, atsha204-rng.c */
+extern struct device_attribute dev_attr_rng_rate;
+void atsha204_rng_init(struct atsha204_chip *chip);
+int atsha204_rng_add_device(struct atsha204_chip *chip);
+void atsha204_rng_del_device(struct atsha204_chip *chip);
+
+/* Chip seeded DRBG, atsha204-drbg.c */
+int atsha204_drbg_add_device(struct atsha204_chip *chip);
+void atsha204_drbg_del_device(struct atsha204_chip *chip);
+void atsha204_drbg_free(struct atsha204_chip *chip);
+
+static inline void atsha204_set_params(struct atsha204_cmd_metadata *cmd,
+                                       int expected_rec_len,
+                                       unsigned long usleep)
 {
     cmd->expected_rec_len = expected_rec_len;
     cmd->usleep = usleep;
 }
 
-static int atsha204_i2c_rng_read(struct hwrng *rng, void *data,
-                                 size_t max, bool wait)
-{
-    return atsha204_i2c_get_random(data, max);
-}
-
-static struct hwrng atsha204_i2c_rng = {
-    .name = ATSHA204_RNG_NAME,
-    .read = atsha204_i2c_rng_read,
-};
-
-/* Validation functions */
-int validate_write_size(const size_t count);
-
 #endif /* _ATSHA204_I2C_H_ */
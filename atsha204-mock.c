@@ -0,0 +1,171 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * In-memory ATSHA204 for the KUnit tests
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Behaves like the chip as the transaction engine sees it: it answers
+ * a wake pulse with the wake token, NACKs while a command "executes",
+ * then hands out the programmed response. Tests set the number of
+ * NACKs, bus faults and the time each transfer takes, and read back
+ * what was sent.
+ */
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/delay.h>
+#include "atsha204-i2c.h"
+
+static const u8 atsha204_mock_wake_token[] = {0x04, 0x11, 0x33, 0x43};
+
+static struct atsha204_mock *to_mock(struct atsha204_chip *chip)
+{
+        return chip->transport_priv;
+}
+
+static void atsha204_mock_delay(struct atsha204_mock *mock)
+{
+        if (mock->delay_us)
+                usleep_range(mock->delay_us, mock->delay_us + 1);
+}
+
+/* Program the response to the next commands, without count and CRC */
+void atsha204_mock_set_rsp(struct atsha204_mock *mock, const u8 *data,
+                           size_t len)
+{
+        u16 crc;
+
+        mock->rsp_len = len + 3;
+        mock->rsp[0] = mock->rsp_len;
+        memcpy(&mock->rsp[1], data, len);
+
+        crc = atsha204_crc16(mock->rsp, len + 1);
+        mock->rsp[len + 1] = crc & 0xFF;
+        mock->rsp[len + 2] = crc >> 8;
+}
+
+static int atsha204_mock_wake(struct atsha204_chip *chip)
+{
+        struct atsha204_mock *mock = to_mock(chip);
+
+        mock->wakes++;
+        atsha204_mock_delay(mock);
+
+        if (mock->wake_nacks){
+                mock->wake_nacks--;
+                return -ENXIO;
+        }
+
+        mock->awake = true;
+        mock->pending = false;
+        memcpy(mock->out, atsha204_mock_wake_token,
+               sizeof(atsha204_mock_wake_token));
+        mock->out_len = sizeof(atsha204_mock_wake_token);
+        mock->out_pos = 0;
+
+        /* Nothing to read, so the token read fails */
+        if (mock->lost_tokens){
+                mock->lost_tokens--;
+                mock->out_len = 0;
+        }
+
+        return 0;
+}
+
+static int atsha204_mock_send(struct atsha204_chip *chip, const u8 *buf,
+                              int len)
+{
+        struct atsha204_mock *mock = to_mock(chip);
+
+        mock->sends++;
+        atsha204_mock_delay(mock);
+
+        if (!mock->awake)
+                return -ENXIO;
+
+        if (1 == len){
+                if (ATSHA204_SLEEP == buf[0])
+                        mock->sleeps++;
+                else
+                        mock->idles++;
+
+                mock->awake = false;
+                return len;
+        }
+
+        mock->cmd_len = min_t(size_t, len, sizeof(mock->cmd));
+        memcpy(mock->cmd, buf, mock->cmd_len);
+
+        if (0 == mock->rsp_len){
+                const u8 success = 0x00;
+
+                atsha204_mock_set_rsp(mock, &success, 1);
+        }
+
+        memcpy(mock->out, mock->rsp, mock->rsp_len);
+        mock->out_len = mock->rsp_len;
+        mock->out_pos = 0;
+
+        if (mock->corrupt_rsp)
+                mock->out[1] ^= 0x01;
+
+        mock->nacks_left = mock->busy_polls;
+        mock->pending = true;
+
+        return len;
+}
+
+static int atsha204_mock_recv(struct atsha204_chip *chip, u8 *buf, int len)
+{
+        struct atsha204_mock *mock = to_mock(chip);
+
+        mock->recvs++;
+        atsha204_mock_delay(mock);
+
+        if (!mock->awake)
+                return -ENXIO;
+
+        if (mock->pending && mock->bus_faults){
+                mock->bus_faults--;
+                return mock->fault_error;
+        }
+
+        if (mock->pending && mock->nacks_left){
+                mock->nacks_left--;
+                return -ENXIO;
+        }
+
+        if (mock->out_pos + len > mock->out_len)
+                return -EIO;
+
+        memcpy(buf, &mock->out[mock->out_pos], len);
+        mock->out_pos += len;
+
+        return len;
+}
+
+static void atsha204_mock_lock(struct atsha204_chip *chip)
+{
+}
+
+static void atsha204_mock_unlock(struct atsha204_chip *chip)
+{
+}
+
+static int atsha204_mock_recover(struct atsha204_chip *chip)
+{
+        to_mock(chip)->recovers++;
+
+        return 0;
+}
+
+const struct atsha204_transport atsha204_mock_transport = {
+        .name = "mock",
+        .send = atsha204_mock_send,
+        .recv = atsha204_mock_recv,
+        .wake = atsha204_mock_wake,
+        .lock = atsha204_mock_lock,
+        .unlock = atsha204_mock_unlock,
+        .recover = atsha204_mock_recover,
+};
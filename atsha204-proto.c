@@ -0,0 +1,524 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * ATSHA204 packet framing and response validation
+ *
+ * Split out of atsha204-i2c-core.c. The CRC and response checks
+ * carried over from there are Copyright (C) 2014 Josh Datko,
+ * Cryptotronix, jbd@cryptotronix.com.
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "atsha204-proto.h"
+
+u16 atsha204_crc16(const u8 *buf, const u8 len)
+{
+        u8 i;
+        u16 crc16 = 0;
+
+        for (i = 0; i < len; i++) {
+                u8 shift;
+
+                for (shift = 0x01; shift > 0x00; shift <<= 1) {
+                        u8 data_bit = (buf[i] & shift) ? 1 : 0;
+                        u8 crc_bit = crc16 >> 15;
+
+                        crc16 <<= 1;
+
+                        if ((data_bit ^ crc_bit) != 0)
+                                crc16 ^= 0x8005;
+                }
+        }
+
+        return crc16;
+}
+
+bool atsha204_crc16_matches(const u8 *buf, const u8 len, const u16 crc)
+{
+        u16 crc_calc = atsha204_crc16(buf,len);
+        return (crc == crc_calc) ? true : false;
+}
+
+bool atsha204_check_rsp_crc16(const u8 *buf, const u8 len)
+{
+        u16 rec_crc;
+
+        if (len < 3)
+                return false;
+
+        /* The CRC is sent least significant byte first */
+        rec_crc = buf[len - 2] | (buf[len - 1] << 8);
+        return atsha204_crc16_matches(buf, len - 2, rec_crc);
+}
+
+int atsha204_i2c_validate_rsp(const struct atsha204_buffer *packet,
+                              struct atsha204_buffer *rsp)
+{
+        int rc;
+
+        if (packet->len < ATSHA204_RSP_MIN_LEN ||
+            packet->len > ATSHA204_RSP_MAX_LEN ||
+            packet->ptr[0] != packet->len)
+                goto out_bad_msg;
+        else if (atsha204_check_rsp_crc16(packet->ptr, packet->len)){
+                rsp->ptr = packet->ptr + 1;
+                rsp->len = packet->len - 3;
+                rc = 0;
+                goto out;
+        }
+        else
+                /* CRC failed */
+
+out_bad_msg:
+        rc = -EBADMSG;
+out:
+        return rc;
+}
+
+int atsha204_rsp_packet_len(const u8 *status_packet)
+{
+        /* The count byte comes straight off the bus, so it is not
+           trusted until it is known to fit the chip's buffer */
+        int packet_len = status_packet[0];
+
+        if (packet_len < ATSHA204_RSP_MIN_LEN ||
+            packet_len > ATSHA204_RSP_MAX_LEN)
+                return -EBADMSG;
+
+        return packet_len;
+}
+
+void atsha204_i2c_crc_command(u8 *cmd, int len)
+{
+        /* The command packet is:
+           [0x03] [Length=1 + command + CRC] [cmd] [crc]
+
+           The CRC is calculated over:
+           CRC([Len] [cmd]) */
+        int crc_data_len = len - 2 - 1;
+        u16 crc = atsha204_crc16(&cmd[1], crc_data_len);
+
+
+        cmd[len - 2] = crc & 0xFF;
+        cmd[len - 1] = crc >> 8;
+}
+
+int atsha204_frame_command(u8 *packet, const size_t cmd_len)
+{
+        /* The command is already at packet[ATSHA204_CMD_OFFSET], add
+           the word address, the count and the CRC around it. */
+        const int send_size = ATSHA204_PACKET_LEN(cmd_len);
+        int rc;
+
+        if ((rc = validate_write_size(cmd_len)))
+                return rc;
+
+        packet[0] = ATSHA204_COMMAND;
+        /* Length byte = command size + crc size + length byte */
+        packet[1] = cmd_len + 2 + 1;
+
+        atsha204_i2c_crc_command(packet, send_size);
+
+        return send_size;
+}
+
+#define ATSHA204_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Maximum execution times from the ATSHA204 datasheet */
+static const struct atsha204_exec_time atsha204_exec_times[] = {
+        {ATSHA204_OP_CHECKMAC, 38},
+        {ATSHA204_OP_DERIVEKEY, 62},
+        {ATSHA204_OP_DEVREV, 2},
+        {ATSHA204_OP_GENDIG, 43},
+        {ATSHA204_OP_HMAC, 69},
+        {ATSHA204_OP_LOCK, 24},
+        {ATSHA204_OP_MAC, 35},
+        {ATSHA204_OP_NONCE, 60},
+        {ATSHA204_OP_PAUSE, 2},
+        {ATSHA204_OP_RANDOM, 50},
+        {ATSHA204_OP_READ, 4},
+        {ATSHA204_OP_SHA, 22},
+        {ATSHA204_OP_UPDATEEXTRA, 12},
+        {ATSHA204_OP_WRITE, 42},
+};
+
+/* The ATSHA204A datasheet allows slightly more for a Read */
+static const struct atsha204_exec_time atsha204a_exec_times[] = {
+        {ATSHA204_OP_CHECKMAC, 38},
+        {ATSHA204_OP_DERIVEKEY, 62},
+        {ATSHA204_OP_DEVREV, 2},
+        {ATSHA204_OP_GENDIG, 43},
+        {ATSHA204_OP_HMAC, 69},
+        {ATSHA204_OP_LOCK, 24},
+        {ATSHA204_OP_MAC, 35},
+        {ATSHA204_OP_NONCE, 60},
+        {ATSHA204_OP_PAUSE, 2},
+        {ATSHA204_OP_RANDOM, 50},
+        {ATSHA204_OP_READ, 5},
+        {ATSHA204_OP_SHA, 22},
+        {ATSHA204_OP_UPDATEEXTRA, 12},
+        {ATSHA204_OP_WRITE, 42},
+};
+
+static const struct atsha204_exec_time atecc108a_exec_times[] = {
+        {ATSHA204_OP_CHECKMAC, 13},
+        {ATSHA204_OP_COUNTER, 20},
+        {ATSHA204_OP_DERIVEKEY, 50},
+        {ATSHA204_OP_DEVREV, 2},
+        {ATSHA204_OP_GENDIG, 11},
+        {ATSHA204_OP_GENKEY, 115},
+        {ATSHA204_OP_HMAC, 23},
+        {ATSHA204_OP_LOCK, 32},
+        {ATSHA204_OP_MAC, 14},
+        {ATSHA204_OP_NONCE, 29},
+        {ATSHA204_OP_PAUSE, 3},
+        {ATSHA204_OP_PRIVWRITE, 48},
+        {ATSHA204_OP_RANDOM, 23},
+        {ATSHA204_OP_READ, 1},
+        {ATSHA204_OP_SHA, 9},
+        {ATSHA204_OP_SIGN, 60},
+        {ATSHA204_OP_UPDATEEXTRA, 10},
+        {ATSHA204_OP_VERIFY, 72},
+        {ATSHA204_OP_WRITE, 26},
+};
+
+/* The ATECC108A set plus ECDH */
+static const struct atsha204_exec_time atecc508a_exec_times[] = {
+        {ATSHA204_OP_CHECKMAC, 13},
+        {ATSHA204_OP_COUNTER, 20},
+        {ATSHA204_OP_DERIVEKEY, 50},
+        {ATSHA204_OP_DEVREV, 2},
+        {ATSHA204_OP_ECDH, 58},
+        {ATSHA204_OP_GENDIG, 11},
+        {ATSHA204_OP_GENKEY, 115},
+        {ATSHA204_OP_HMAC, 23},
+        {ATSHA204_OP_LOCK, 32},
+        {ATSHA204_OP_MAC, 14},
+        {ATSHA204_OP_NONCE, 29},
+        {ATSHA204_OP_PAUSE, 3},
+        {ATSHA204_OP_PRIVWRITE, 48},
+        {ATSHA204_OP_RANDOM, 23},
+        {ATSHA204_OP_READ, 2},
+        {ATSHA204_OP_SHA, 9},
+        {ATSHA204_OP_SIGN, 60},
+        {ATSHA204_OP_UPDATEEXTRA, 10},
+        {ATSHA204_OP_VERIFY, 72},
+        {ATSHA204_OP_WRITE, 26},
+};
+
+/* The ATECC608A drops HMAC and Pause and adds AES, KDF and the boot
+   and self tests */
+static const struct atsha204_exec_time atecc608a_exec_times[] = {
+        {ATSHA204_OP_AES, 27},
+        {ATSHA204_OP_CHECKMAC, 40},
+        {ATSHA204_OP_COUNTER, 25},
+        {ATSHA204_OP_DERIVEKEY, 50},
+        {ATSHA204_OP_DEVREV, 5},
+        {ATSHA204_OP_ECDH, 75},
+        {ATSHA204_OP_GENDIG, 25},
+        {ATSHA204_OP_GENKEY, 115},
+        {ATSHA204_OP_KDF, 165},
+        {ATSHA204_OP_LOCK, 35},
+        {ATSHA204_OP_MAC, 55},
+        {ATSHA204_OP_NONCE, 20},
+        {ATSHA204_OP_PRIVWRITE, 50},
+        {ATSHA204_OP_RANDOM, 23},
+        {ATSHA204_OP_READ, 5},
+        {ATSHA204_OP_SECUREBOOT, 80},
+        {ATSHA204_OP_SELFTEST, 250},
+        {ATSHA204_OP_SHA, 36},
+        {ATSHA204_OP_SIGN, 115},
+        {ATSHA204_OP_UPDATEEXTRA, 10},
+        {ATSHA204_OP_VERIFY, 105},
+        {ATSHA204_OP_WRITE, 45},
+};
+
+#define ATSHA204_VARIANT(_name, _times, _max_count, _config, _sha204, _wake) \
+        {                                                               \
+                .name = _name,                                          \
+                .exec_times = _times,                                   \
+                .n_exec_times = ATSHA204_ARRAY_SIZE(_times),            \
+                .max_count = _max_count,                                \
+                .config_size = _config,                                 \
+                .sha204_config = _sha204,                               \
+                .wake_delay_us = _wake,                                 \
+        }
+
+const struct atsha204_variant atsha204_variants[ATSHA204_VARIANT_COUNT] = {
+        [ATSHA204_VARIANT_SHA204] = ATSHA204_VARIANT("ATSHA204",
+                atsha204_exec_times, 84, 88, true, 2500),
+        [ATSHA204_VARIANT_SHA204A] = ATSHA204_VARIANT("ATSHA204A",
+                atsha204a_exec_times, 84, 88, true, 2500),
+        [ATSHA204_VARIANT_ECC108A] = ATSHA204_VARIANT("ATECC108A",
+                atecc108a_exec_times, 155, 128, false, 2500),
+        [ATSHA204_VARIANT_ECC508A] = ATSHA204_VARIANT("ATECC508A",
+                atecc508a_exec_times, 155, 128, false, 1500),
+        [ATSHA204_VARIANT_ECC608A] = ATSHA204_VARIANT("ATECC608A",
+                atecc608a_exec_times, 155, 128, false, 1500),
+};
+
+static const struct atsha204_exec_time *
+atsha204_find_exec_time(const struct atsha204_variant *variant,
+                        const u8 opcode)
+{
+        size_t i;
+
+        for (i = 0; i < variant->n_exec_times; i++)
+                if (variant->exec_times[i].opcode == opcode)
+                        return &variant->exec_times[i];
+
+        return NULL;
+}
+
+unsigned int atsha204_exec_time_ms(const struct atsha204_variant *variant,
+                                   const u8 opcode)
+{
+        const struct atsha204_exec_time *t;
+        unsigned int ms = 0;
+        size_t i;
+
+        if ((t = atsha204_find_exec_time(variant, opcode)))
+                return t->max_ms;
+
+        /* Unknown opcodes get the longest time of any command */
+        for (i = 0; i < variant->n_exec_times; i++)
+                if (variant->exec_times[i].max_ms > ms)
+                        ms = variant->exec_times[i].max_ms;
+
+        return ms;
+}
+
+bool atsha204_variant_supports(const struct atsha204_variant *variant,
+                               const u8 opcode)
+{
+        return atsha204_find_exec_time(variant, opcode) != NULL;
+}
+
+/*
+ * Map a DevRev (Info on the ATECC parts) answer to a part. Byte 2
+ * names the family, and on the ATSHA204 family byte 3 is the silicon
+ * revision, where the A parts start at 9. Returns NULL for anything
+ * not known.
+ */
+const struct atsha204_variant *atsha204_variant_from_rev(const u8 *rev)
+{
+        switch (rev[2]){
+        case 0x00:
+        case 0x02:
+                return &atsha204_variants[(rev[3] >= 0x09) ?
+                                          ATSHA204_VARIANT_SHA204A :
+                                          ATSHA204_VARIANT_SHA204];
+        case 0x10:
+                return &atsha204_variants[ATSHA204_VARIANT_ECC108A];
+        case 0x50:
+                return &atsha204_variants[ATSHA204_VARIANT_ECC508A];
+        case 0x60:
+                return &atsha204_variants[ATSHA204_VARIANT_ECC608A];
+        default:
+                return NULL;
+        }
+}
+
+/*
+ * The lock bytes sit at the same place on every variant. The rest is
+ * only decoded on the ATSHA204 layout; on the ATECC parts byte 18 is
+ * CountMatch or reserved, the slot bits mean other things and Lock
+ * has a per-slot mode, so their commands are left unchecked.
+ */
+int atsha204_parse_config(const u8 *config, const size_t len,
+                          const struct atsha204_variant *variant,
+                          struct atsha204_policy *policy)
+{
+        static const struct atsha204_policy unchecked;
+        int i;
+
+        if (len < ATSHA204_CONFIG_PARSE_LEN)
+                return -EINVAL;
+
+        *policy = unchecked;
+        policy->config_locked =
+                config[ATSHA204_CONFIG_LOCK_CONFIG] != ATSHA204_LOCK_UNLOCKED;
+        policy->data_locked =
+                config[ATSHA204_CONFIG_LOCK_DATA] != ATSHA204_LOCK_UNLOCKED;
+        policy->valid = true;
+
+        if (!variant->sha204_config)
+                return 0;
+
+        policy->checked = true;
+        policy->otp_mode = config[ATSHA204_CONFIG_OTP_MODE];
+
+        for (i = 0; i < ATSHA204_SLOT_COUNT; i++){
+                struct atsha204_slot_policy *slot = &policy->slots[i];
+                const u8 *raw = &config[ATSHA204_CONFIG_SLOT_CONFIG + 2 * i];
+                u16 sc = raw[0] | (raw[1] << 8);
+
+                slot->slot_config = sc;
+                slot->read_key = sc & 0x0F;
+                slot->check_only = sc & 0x0010;
+                slot->single_use = sc & 0x0020;
+                slot->encrypt_read = sc & 0x0040;
+                slot->is_secret = sc & 0x0080;
+                slot->write_key = (sc >> 8) & 0x0F;
+                slot->write_config = sc >> 12;
+        }
+
+        return 0;
+}
+
+/* Slot addressed by the Param2 of a data zone Read or Write */
+static int atsha204_data_slot(const u16 addr)
+{
+        return (addr >> 3) & 0x0F;
+}
+
+static int atsha204_check_read(const struct atsha204_policy *policy,
+                               const u8 param1, const u16 addr)
+{
+        const struct atsha204_slot_policy *slot;
+
+        switch (param1 & 0x03){
+        case 0:
+                /* The config zone can always be read */
+                return 0;
+        case 1:
+                return policy->data_locked ? 0 : -EACCES;
+        default:
+                break;
+        }
+
+        if (!policy->data_locked)
+                return -EACCES;
+
+        slot = &policy->slots[atsha204_data_slot(addr)];
+
+        if (!slot->is_secret)
+                return 0;
+
+        /* Secret slots only come out as encrypted 32 byte reads */
+        if (slot->encrypt_read && (param1 & 0x80))
+                return 0;
+
+        return -EACCES;
+}
+
+static int atsha204_check_write(const struct atsha204_policy *policy,
+                                const u8 param1, const u16 addr)
+{
+        const struct atsha204_slot_policy *slot;
+        const u16 LOCK_WORD = ATSHA204_CONFIG_LOCK_DATA / 4;
+
+        switch (param1 & 0x03){
+        case 0:
+                /* Serial, revision and lock words are not writable */
+                if (policy->config_locked || addr < 4 || addr == LOCK_WORD)
+                        return -EACCES;
+                return 0;
+        case 1:
+                if (policy->data_locked &&
+                    (policy->otp_mode == ATSHA204_OTP_READ_ONLY ||
+                     policy->otp_mode == ATSHA204_OTP_LEGACY))
+                        return -EACCES;
+                return 0;
+        default:
+                break;
+        }
+
+        /* Anything goes until the data zone is locked */
+        if (!policy->data_locked)
+                return 0;
+
+        slot = &policy->slots[atsha204_data_slot(addr)];
+
+        /* WriteConfig 10x0 is Never */
+        if ((slot->write_config & 0x0D) == 0x08)
+                return -EACCES;
+
+        /* WriteConfig x1xx needs encrypted input */
+        if ((slot->write_config & 0x04) && !(param1 & 0x40))
+                return -EACCES;
+
+        return 0;
+}
+
+/*
+ * Reject commands that the chip is certain to refuse given its
+ * config zone, before they cost a trip over the bus. Anything the
+ * policy can't rule out is passed through for the chip to decide.
+ */
+int atsha204_policy_check(const struct atsha204_policy *policy,
+                          const u8 *cmd, const size_t len)
+{
+        u8 opcode, param1;
+        u16 param2;
+
+        if (!policy->checked || len < 4)
+                return 0;
+
+        opcode = cmd[0];
+        param1 = cmd[1];
+        param2 = cmd[2] | (cmd[3] << 8);
+
+        switch (opcode){
+        case ATSHA204_OP_READ:
+                return atsha204_check_read(policy, param1, param2);
+        case ATSHA204_OP_WRITE:
+                return atsha204_check_write(policy, param1, param2);
+        case ATSHA204_OP_LOCK:
+                if (0 == (param1 & 0x03))
+                        return policy->config_locked ? -EACCES : 0;
+                /* The data zone can only be locked after the config */
+                return (!policy->config_locked || policy->data_locked) ?
+                        -EACCES : 0;
+        case ATSHA204_OP_MAC:
+                if (!policy->data_locked)
+                        return -EACCES;
+                /* Mode bit 1 takes the key from TempKey, not the slot.
+                   Bit 0 only puts TempKey in the second SHA block */
+                if (!(param1 & 0x02) &&
+                    policy->slots[param2 & 0x0F].check_only)
+                        return -EACCES;
+                return 0;
+        case ATSHA204_OP_HMAC:
+                if (!policy->data_locked ||
+                    policy->slots[param2 & 0x0F].check_only)
+                        return -EACCES;
+                return 0;
+        case ATSHA204_OP_GENDIG:
+        case ATSHA204_OP_CHECKMAC:
+        case ATSHA204_OP_DERIVEKEY:
+                return policy->data_locked ? 0 : -EACCES;
+        default:
+                return 0;
+        }
+}
+
+int validate_write_size(const size_t count)
+{
+        const int MIN_SIZE = 4;
+        /* Header and CRC occupy 4 bytes and the length is a one byte
+           value */
+        const int MAX_SIZE = 255 - 4;
+        int rc = -EMSGSIZE;
+
+        if (count <= MAX_SIZE && count >= MIN_SIZE)
+                rc = 0;
+
+        return rc;
+
+}
+
+/* Refuse what the part would only answer with a parse error */
+int atsha204_variant_check(const struct atsha204_variant *variant,
+                           const u8 *cmd, const size_t len)
+{
+        /* The count byte covers itself, the command and the CRC */
+        if (len + 3 > variant->max_count)
+                return -EMSGSIZE;
+
+        if (!atsha204_variant_supports(variant, cmd[0]))
+                return -EOPNOTSUPP;
+
+        return 0;
+}
@@ -0,0 +1,174 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * ATSHA204 packet framing and response validation
+ *
+ * Split out of atsha204-i2c-core.c. The CRC and response checks
+ * carried over from there are Copyright (C) 2014 Josh Datko,
+ * Cryptotronix, jbd@cryptotronix.com.
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Nothing in here touches the bus or the kernel, so the same file
+ * builds into the module and into the user space test library.
+ */
+#ifndef _ATSHA204_PROTO_H_
+#define _ATSHA204_PROTO_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/errno.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+#endif
+
+/* I2C word address, the first byte of every write to the chip */
+#define ATSHA204_SLEEP 0x01
+#define ATSHA204_IDLE 0x02
+#define ATSHA204_COMMAND 0x03
+
+/* Command opcodes */
+#define ATSHA204_OP_PAUSE 0x01
+#define ATSHA204_OP_READ 0x02
+#define ATSHA204_OP_MAC 0x08
+#define ATSHA204_OP_HMAC 0x11
+#define ATSHA204_OP_WRITE 0x12
+#define ATSHA204_OP_GENDIG 0x15
+#define ATSHA204_OP_NONCE 0x16
+#define ATSHA204_OP_LOCK 0x17
+#define ATSHA204_OP_RANDOM 0x1B
+#define ATSHA204_OP_DERIVEKEY 0x1C
+#define ATSHA204_OP_UPDATEEXTRA 0x20
+#define ATSHA204_OP_CHECKMAC 0x28
+#define ATSHA204_OP_DEVREV 0x30
+#define ATSHA204_OP_SHA 0x47
+/* ATECC only. Info shares its opcode with DevRev */
+#define ATSHA204_OP_COUNTER 0x24
+#define ATSHA204_OP_GENKEY 0x40
+#define ATSHA204_OP_SIGN 0x41
+#define ATSHA204_OP_ECDH 0x43
+#define ATSHA204_OP_VERIFY 0x45
+#define ATSHA204_OP_PRIVWRITE 0x46
+#define ATSHA204_OP_AES 0x51
+#define ATSHA204_OP_KDF 0x56
+#define ATSHA204_OP_SELFTEST 0x77
+#define ATSHA204_OP_SECUREBOOT 0x80
+
+/* [Word address (1)][Count (1)][Opcode (1)][Param1 (1)][Param2 (2)]
+   [Data (x)][CRC (2)] */
+#define ATSHA204_CMD_OFFSET 2
+#define ATSHA204_PACKET_LEN(cmd_len) ((cmd_len) + 4)
+
+/* A response is [Count (1)][Data (x)][CRC (2)] where the smallest is
+   a single status byte and the largest fills the chip's I/O buffer */
+#define ATSHA204_RSP_MIN_LEN 4
+#define ATSHA204_RSP_MAX_LEN 84
+
+/* Config zone layout */
+#define ATSHA204_CONFIG_OTP_MODE 18
+#define ATSHA204_CONFIG_SLOT_CONFIG 20
+#define ATSHA204_CONFIG_LOCK_DATA 86
+#define ATSHA204_CONFIG_LOCK_CONFIG 87
+#define ATSHA204_CONFIG_PARSE_LEN 88
+#define ATSHA204_LOCK_UNLOCKED 0x55
+#define ATSHA204_SLOT_COUNT 16
+
+/* OTPmode values */
+#define ATSHA204_OTP_READ_ONLY 0xAA
+#define ATSHA204_OTP_CONSUMPTION 0x55
+#define ATSHA204_OTP_LEGACY 0x00
+
+/* One SlotConfig entry, decoded */
+struct atsha204_slot_policy {
+    u16 slot_config;
+    u8 read_key;
+    u8 write_key;
+    u8 write_config;
+    bool check_only;
+    bool single_use;
+    bool encrypt_read;
+    bool is_secret;
+};
+
+/* What the config zone allows, as far as it can be known up front */
+struct atsha204_policy {
+    bool valid;
+    bool config_locked;
+    bool data_locked;
+    /* Set when OTPmode and the slots below were decoded and commands
+       are checked, which is only done on the ATSHA204 layout */
+    bool checked;
+    u8 otp_mode;
+    struct atsha204_slot_policy slots[ATSHA204_SLOT_COUNT];
+};
+
+struct atsha204_exec_time {
+    u8 opcode;
+    u8 max_ms;
+};
+
+/* Parts that share the ATSHA204 pinout and packet format */
+enum atsha204_variant_id {
+    ATSHA204_VARIANT_SHA204,
+    ATSHA204_VARIANT_SHA204A,
+    ATSHA204_VARIANT_ECC108A,
+    ATSHA204_VARIANT_ECC508A,
+    ATSHA204_VARIANT_ECC608A,
+    ATSHA204_VARIANT_COUNT
+};
+
+/* What differs between them as far as the driver is concerned. The
+   opcodes a part supports are the ones in its exec_times table */
+struct atsha204_variant {
+    const char *name;
+    const struct atsha204_exec_time *exec_times;
+    size_t n_exec_times;
+    /* Largest count byte the input buffer takes */
+    u8 max_count;
+    u8 config_size;
+    /* Config zone and Lock modes as on the ATSHA204. The ATECC parts
+       only share the lock bytes with it */
+    bool sha204_config;
+    /* tWHI, from the wake pulse to the chip answering */
+    unsigned int wake_delay_us;
+};
+
+extern const struct atsha204_variant atsha204_variants[ATSHA204_VARIANT_COUNT];
+
+struct atsha204_buffer {
+    u8 *ptr;
+    int len;
+};
+
+u16 atsha204_crc16(const u8 *buf, const u8 len);
+bool atsha204_crc16_matches(const u8 *buf, const u8 len, const u16 crc);
+bool atsha204_check_rsp_crc16(const u8 *buf, const u8 len);
+int atsha204_i2c_validate_rsp(const struct atsha204_buffer *packet,
+                              struct atsha204_buffer *rsp);
+int atsha204_rsp_packet_len(const u8 *status_packet);
+void atsha204_i2c_crc_command(u8 *cmd, int len);
+int atsha204_frame_command(u8 *packet, const size_t cmd_len);
+unsigned int atsha204_exec_time_ms(const struct atsha204_variant *variant,
+                                  const u8 opcode);
+bool atsha204_variant_supports(const struct atsha204_variant *variant,
+                               const u8 opcode);
+const struct atsha204_variant *atsha204_variant_from_rev(const u8 *rev);
+int atsha204_parse_config(const u8 *config, const size_t len,
+                          const struct atsha204_variant *variant,
+                          struct atsha204_policy *policy);
+int atsha204_policy_check(const struct atsha204_policy *policy,
+                          const u8 *cmd, const size_t len);
+
+/* Validation functions */
+int validate_write_size(const size_t count);
+int atsha204_variant_check(const struct atsha204_variant *variant,
+                           const u8 *cmd, const size_t len);
+
+#endif /* _ATSHA204_PROTO_H_ */
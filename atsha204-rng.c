@@ -0,0 +1,221 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * hwrng front end for the ATSHA204
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The hwrng core and rngd read as fast as they are allowed to, which
+ * without a limit keeps the chip busy with Random commands. Each chip
+ * gets a token bucket of Random commands per second, and bytes left
+ * over from a command are pooled for the next reader.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/hw_random.h>
+#include "atsha204-i2c.h"
+
+static unsigned short rng_quality;
+module_param(rng_quality, ushort, 0444);
+MODULE_PARM_DESC(rng_quality,
+                 "hwrng entropy estimate per 1024 bits, 0 for the default");
+
+static unsigned int rng_rate = 10;
+module_param(rng_rate, uint, 0444);
+MODULE_PARM_DESC(rng_rate,
+                 "Initial Random commands per second for hwrng, 0 for no limit");
+
+/*
+ * Take a token if one is available, otherwise say how long until the
+ * next one. The bucket holds one second's worth of commands. It is
+ * kept as the time the next token is due (GCRA), so no timer is
+ * needed to refill it. Called with rng_lock held.
+ */
+static bool atsha204_rng_take_token(struct atsha204_chip *chip, u64 *wait_ns)
+{
+        const unsigned int rate = READ_ONCE(chip->rng_rate);
+        const u64 now = ktime_get_ns();
+        u64 interval, limit;
+
+        if (0 == rate)
+                return true;
+
+        interval = div_u64(NSEC_PER_SEC, rate);
+        limit = now + (rate - 1) * interval;
+
+        if (chip->rng_tat < now)
+                chip->rng_tat = now;
+
+        if (chip->rng_tat > limit){
+                *wait_ns = chip->rng_tat - limit;
+                return false;
+        }
+
+        chip->rng_tat += interval;
+        return true;
+}
+
+/* Hand out pooled bytes from the end. Called with rng_lock held */
+static int atsha204_rng_from_pool(struct atsha204_chip *chip, u8 *data,
+                                  size_t max)
+{
+        const int n = min_t(size_t, max, chip->rng_pool_len);
+
+        chip->rng_pool_len -= n;
+        memcpy(data, &chip->rng_pool[chip->rng_pool_len], n);
+        memzero_explicit(&chip->rng_pool[chip->rng_pool_len], n);
+
+        return n;
+}
+
+/* Called with rng_lock held and a token taken */
+static int atsha204_rng_fill_pool(struct atsha204_chip *chip)
+{
+        int rc;
+
+        rc = atsha204_i2c_random(chip, chip->rng_pool,
+                                 sizeof(chip->rng_pool), ATSHA204_PRIO_RNG);
+        if (rc > 0)
+                chip->rng_pool_len = rc;
+
+        return rc;
+}
+
+static void atsha204_rng_refill_work(struct work_struct *work)
+{
+        struct atsha204_chip *chip = container_of(work, struct atsha204_chip,
+                                                  rng_refill_work);
+        u64 wait_ns;
+
+        mutex_lock(&chip->rng_lock);
+
+        if (0 == chip->rng_pool_len && atsha204_rng_take_token(chip, &wait_ns))
+                atsha204_rng_fill_pool(chip);
+
+        mutex_unlock(&chip->rng_lock);
+}
+
+/*
+ * With wait set, block until a token allows a Random command. Without
+ * it only bytes already in the pool are returned, and an empty pool
+ * is refilled in the background if the budget allows.
+ */
+static int atsha204_rng_read(struct hwrng *rng, void *data, size_t max,
+                             bool wait)
+{
+        struct atsha204_chip *chip = container_of(rng, struct atsha204_chip,
+                                                  rng);
+        u64 wait_ns;
+        int rc;
+
+        for (;;){
+                if (!wait){
+                        if (!mutex_trylock(&chip->rng_lock))
+                                return 0;
+                }
+                else
+                        mutex_lock(&chip->rng_lock);
+
+                if (chip->rng_pool_len){
+                        rc = atsha204_rng_from_pool(chip, data, max);
+                        goto out_unlock;
+                }
+
+                if (!wait){
+                        mutex_unlock(&chip->rng_lock);
+                        schedule_work(&chip->rng_refill_work);
+                        return 0;
+                }
+
+                if (atsha204_rng_take_token(chip, &wait_ns))
+                        break;
+
+                mutex_unlock(&chip->rng_lock);
+
+                if (msleep_interruptible(DIV_ROUND_UP_ULL(wait_ns,
+                                                          NSEC_PER_MSEC)))
+                        return 0;
+        }
+
+        if ((rc = atsha204_rng_fill_pool(chip)) > 0)
+                rc = atsha204_rng_from_pool(chip, data, max);
+
+out_unlock:
+        mutex_unlock(&chip->rng_lock);
+
+        return rc;
+}
+
+static ssize_t rng_rate_show(struct device *dev,
+                             struct device_attribute *attr,
+                             char *buf)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+
+        return sprintf(buf, "%u\n", READ_ONCE(chip->rng_rate));
+}
+
+static ssize_t rng_rate_store(struct device *dev,
+                              struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+        struct atsha204_chip *chip = dev_get_drvdata(dev);
+        unsigned int rate;
+        int rc;
+
+        if ((rc = kstrtouint(buf, 0, &rate)))
+                return rc;
+
+        WRITE_ONCE(chip->rng_rate, rate);
+
+        return count;
+}
+struct device_attribute dev_attr_rng_rate = __ATTR_RW(rng_rate);
+
+void atsha204_rng_init(struct atsha204_chip *chip)
+{
+        mutex_init(&chip->rng_lock);
+        INIT_WORK(&chip->rng_refill_work, atsha204_rng_refill_work);
+
+        chip->rng_rate = rng_rate;
+
+        scnprintf(chip->rng_name, sizeof(chip->rng_name), "%s%d",
+                  ATSHA204_RNG_NAME, chip->dev_num);
+
+        chip->rng.name = chip->rng_name;
+        chip->rng.read = atsha204_rng_read;
+        chip->rng.quality = rng_quality;
+}
+
+int atsha204_rng_add_device(struct atsha204_chip *chip)
+{
+        int rc;
+
+        if ((rc = hwrng_register(&chip->rng))){
+                dev_err(chip->dev, "%s: %d\n", "HWRNG register failed", rc);
+                return rc;
+        }
+
+        chip->rng_registered = true;
+
+        return 0;
+}
+
+void atsha204_rng_del_device(struct atsha204_chip *chip)
+{
+        if (!chip->rng_registered)
+                return;
+
+        hwrng_unregister(&chip->rng);
+        cancel_work_sync(&chip->rng_refill_work);
+
+        memzero_explicit(chip->rng_pool, sizeof(chip->rng_pool));
+        chip->rng_pool_len = 0;
+        chip->rng_registered = false;
+}
@@ -0,0 +1,130 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * Read-only snapshot of the ATSHA204 identity and zones
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The serial number, revision and config zone only change on Lock and
+ * Write, yet programs read them all the time. They are kept in a page
+ * that /dev/atshaX maps read-only, so a lookup costs neither a system
+ * call nor bus traffic.
+ */
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include "atsha204-i2c.h"
+
+int atsha204_snapshot_init(struct atsha204_chip *chip)
+{
+        struct atsha204_snapshot *snap;
+
+        if (!(snap = (void *)get_zeroed_page(GFP_KERNEL)))
+                return -ENOMEM;
+
+        snap->magic = ATSHA204_SNAPSHOT_MAGIC;
+        snap->version = ATSHA204_SNAPSHOT_VERSION;
+
+        mutex_init(&chip->snapshot_lock);
+        chip->snapshot = snap;
+
+        return 0;
+}
+
+void atsha204_snapshot_free(struct atsha204_chip *chip)
+{
+        free_page((unsigned long)chip->snapshot);
+        chip->snapshot = NULL;
+}
+
+/*
+ * Read the rest from the chip first, then rewrite the page between
+ * two generation bumps. config is a config zone the caller has just
+ * read, or NULL if it couldn't. Parts that could not be read have
+ * their flag cleared rather than keeping data that may be stale.
+ */
+int atsha204_snapshot_update(struct atsha204_chip *chip, const u8 *config)
+{
+        struct atsha204_snapshot *snap = chip->snapshot;
+        u8 otp[ATSHA204_OTP_ZONE_SIZE];
+        u8 rev[ATSHA204_WORD_SIZE];
+        u32 flags = 0;
+        ssize_t rc;
+
+        if (config)
+                flags |= ATSHA204_SNAPSHOT_CONFIG;
+
+        if (sizeof(rev) == atsha204_i2c_devrev(chip, rev))
+                flags |= ATSHA204_SNAPSHOT_REVISION;
+
+        if ((flags & ATSHA204_SNAPSHOT_CONFIG) &&
+            ATSHA204_LOCK_UNLOCKED != config[ATSHA204_CONFIG_LOCK_DATA]){
+                rc = atsha204_i2c_read_zone(chip, ATSHA204_ZONE_OTP,
+                                            sizeof(otp), otp,
+                                            0, sizeof(otp));
+                if (sizeof(otp) == rc)
+                        flags |= ATSHA204_SNAPSHOT_OTP;
+        }
+
+        mutex_lock(&chip->snapshot_lock);
+
+        WRITE_ONCE(snap->generation, snap->generation + 1);
+        smp_wmb();
+
+        if (flags & ATSHA204_SNAPSHOT_CONFIG){
+                memcpy(snap->config, config, sizeof(snap->config));
+                /* SN[0:3] and SN[4:8] sit either side of RevNum */
+                memcpy(&snap->serial[0], &config[0], 4);
+                memcpy(&snap->serial[4], &config[8], 5);
+        }
+
+        if (flags & ATSHA204_SNAPSHOT_REVISION)
+                memcpy(snap->revision, rev, sizeof(rev));
+
+        if (flags & ATSHA204_SNAPSHOT_OTP)
+                memcpy(snap->otp, otp, sizeof(otp));
+
+        snap->flags = flags;
+
+        smp_wmb();
+        WRITE_ONCE(snap->generation, snap->generation + 1);
+
+        mutex_unlock(&chip->snapshot_lock);
+
+        return flags ? 0 : -EIO;
+}
+
+int atsha204_snapshot_refresh(struct atsha204_chip *chip)
+{
+        u8 config[ATSHA204_CONFIG_ZONE_SIZE];
+        ssize_t rc;
+
+        rc = atsha204_i2c_read_zone(chip, ATSHA204_ZONE_CONFIG,
+                                    sizeof(config), config, 0, sizeof(config));
+
+        return atsha204_snapshot_update(chip, (sizeof(config) == rc) ?
+                                        config : NULL);
+}
+
+int atsha204_snapshot_mmap(struct atsha204_chip *chip,
+                           struct vm_area_struct *vma)
+{
+        const unsigned long size = vma->vm_end - vma->vm_start;
+
+        if (vma->vm_pgoff || size > PAGE_SIZE)
+                return -EINVAL;
+
+        if (vma->vm_flags & VM_WRITE)
+                return -EPERM;
+
+        /* Nor may it be made writable later with mprotect() */
+        vma->vm_flags &= ~VM_MAYWRITE;
+
+        /* The mapping holds its own page reference, so the page outlives
+           the chip if a program still has it mapped on remove */
+        return vm_insert_page(vma, vma->vm_start,
+                              virt_to_page(chip->snapshot));
+}
@@ -0,0 +1,135 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * Transaction trace capture for the ATSHA204
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * When enabled, every transaction leaves a struct atsha204_trace_rec
+ * in a per-chip ring. User space drains the ring through debugfs and
+ * can replay it with tools/atsha204-replay.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include "atsha204-i2c.h"
+
+static unsigned int trace_entries = 1024;
+module_param(trace_entries, uint, 0444);
+MODULE_PARM_DESC(trace_entries,
+                 "Transactions kept in each chip's trace ring");
+
+static struct dentry *atsha204_debugfs_root;
+
+void atsha204_trace_record(struct atsha204_chip *chip,
+                           const struct atsha204_trace_rec *rec)
+{
+        unsigned long flags;
+
+        spin_lock_irqsave(&chip->trace_lock, flags);
+
+        /* Keep the newest records, drop the oldest */
+        if (kfifo_is_full(&chip->trace_fifo))
+                kfifo_skip(&chip->trace_fifo);
+
+        kfifo_put(&chip->trace_fifo, *rec);
+
+        spin_unlock_irqrestore(&chip->trace_lock, flags);
+}
+
+static int atsha204_trace_open(struct inode *inode, struct file *filep)
+{
+        filep->private_data = inode->i_private;
+
+        return 0;
+}
+
+static ssize_t atsha204_trace_read(struct file *filep, char __user *buf,
+                                   size_t count, loff_t *f_pos)
+{
+        struct atsha204_chip *chip = filep->private_data;
+        const size_t REC_SIZE = sizeof(struct atsha204_trace_rec);
+        struct atsha204_trace_rec *recs;
+        unsigned long flags;
+        unsigned int n;
+        ssize_t done = 0;
+
+        if (count < REC_SIZE)
+                return -EINVAL;
+
+        if (!(recs = kmalloc(PAGE_SIZE, GFP_KERNEL)))
+                return -ENOMEM;
+
+        while (count - done >= REC_SIZE){
+                n = min_t(size_t, (count - done) / REC_SIZE,
+                          PAGE_SIZE / REC_SIZE);
+
+                spin_lock_irqsave(&chip->trace_lock, flags);
+                n = kfifo_out(&chip->trace_fifo, recs, n);
+                spin_unlock_irqrestore(&chip->trace_lock, flags);
+
+                if (0 == n)
+                        break;
+
+                if (copy_to_user(buf + done, recs, n * REC_SIZE)){
+                        done = done ? done : -EFAULT;
+                        break;
+                }
+
+                done += n * REC_SIZE;
+        }
+
+        kfree(recs);
+
+        return done;
+}
+
+static const struct file_operations atsha204_trace_fops = {
+        .owner = THIS_MODULE,
+        .llseek = no_llseek,
+        .open = atsha204_trace_open,
+        .read = atsha204_trace_read,
+};
+
+int atsha204_trace_add_device(struct atsha204_chip *chip)
+{
+        int rc;
+
+        spin_lock_init(&chip->trace_lock);
+
+        if ((rc = kfifo_alloc(&chip->trace_fifo, max(trace_entries, 2U),
+                              GFP_KERNEL)))
+                return rc;
+
+        chip->debugfs = debugfs_create_dir(chip->devname,
+                                           atsha204_debugfs_root);
+        debugfs_create_bool("trace_enable", 0644, chip->debugfs,
+                            &chip->trace_enabled);
+        debugfs_create_file("trace", 0400, chip->debugfs, chip,
+                            &atsha204_trace_fops);
+
+        return 0;
+}
+
+void atsha204_trace_del_device(struct atsha204_chip *chip)
+{
+        chip->trace_enabled = false;
+        debugfs_remove_recursive(chip->debugfs);
+        kfifo_free(&chip->trace_fifo);
+}
+
+void atsha204_trace_init(void)
+{
+        atsha204_debugfs_root = debugfs_create_dir("atsha204", NULL);
+}
+
+void atsha204_trace_exit(void)
+{
+        debugfs_remove_recursive(atsha204_debugfs_root);
+}
@@ -0,0 +1,204 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * Bus backends of the ATSHA204 driver
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The transaction engine only talks to the chip through struct
+ * atsha204_transport. Adapters that can do plain I2C messages get the
+ * raw backend, SMBus-only controllers the SMBus one. The mock used by
+ * the KUnit tests lives in atsha204-mock.c.
+ */
+#include <linux/kernel.h>
+#include <linux/i2c.h>
+#include "atsha204-i2c.h"
+
+/* Four zero bytes hold SDA low for longer than tWLO */
+static const u8 atsha204_wake_pulse[4];
+
+/*
+ * While the driver holds the adapter lock in bus sharing mode the
+ * unlocked __i2c_transfer has to be used, since i2c_transfer takes
+ * the lock itself.
+ */
+static int atsha204_i2c_xfer(struct atsha204_chip *chip, u16 flags,
+                             u8 *buf, int len)
+{
+        const struct i2c_client *client = chip->client;
+        struct i2c_msg msg = {
+                .addr = client->addr,
+                .flags = (client->flags & I2C_M_TEN) | flags,
+                .len = len,
+                .buf = buf,
+        };
+        int rc;
+
+        if (chip->bus_locked)
+                rc = __i2c_transfer(client->adapter, &msg, 1);
+        else
+                rc = i2c_transfer(client->adapter, &msg, 1);
+
+        return (1 == rc) ? len : rc;
+}
+
+static int atsha204_raw_send(struct atsha204_chip *chip, const u8 *buf,
+                             int len)
+{
+        return atsha204_i2c_xfer(chip, 0, (u8 *)buf, len);
+}
+
+static int atsha204_raw_recv(struct atsha204_chip *chip, u8 *buf, int len)
+{
+        return atsha204_i2c_xfer(chip, I2C_M_RD, buf, len);
+}
+
+static int atsha204_raw_wake(struct atsha204_chip *chip)
+{
+        const int len = sizeof(atsha204_wake_pulse);
+        int rc = atsha204_raw_send(chip, atsha204_wake_pulse, len);
+
+        return (len == rc) ? 0 : ((rc < 0) ? rc : -EIO);
+}
+
+static void atsha204_i2c_lock(struct atsha204_chip *chip)
+{
+        i2c_lock_bus(chip->client->adapter, I2C_LOCK_SEGMENT);
+}
+
+static void atsha204_i2c_unlock(struct atsha204_chip *chip)
+{
+        i2c_unlock_bus(chip->client->adapter, I2C_LOCK_SEGMENT);
+}
+
+/* Clock a stuck bus free, on adapters that know how */
+static int atsha204_i2c_recover_bus(struct atsha204_chip *chip)
+{
+        struct i2c_adapter *adapter = chip->client->adapter;
+        int rc;
+
+        if (!adapter->bus_recovery_info)
+                return -EOPNOTSUPP;
+
+        i2c_lock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+        rc = i2c_recover_bus(adapter);
+        i2c_unlock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+
+        return rc;
+}
+
+const struct atsha204_transport atsha204_raw_transport = {
+        .name = "i2c",
+        .send = atsha204_raw_send,
+        .recv = atsha204_raw_recv,
+        .wake = atsha204_raw_wake,
+        .lock = atsha204_i2c_lock,
+        .unlock = atsha204_i2c_unlock,
+        .recover = atsha204_i2c_recover_bus,
+};
+
+static int atsha204_smbus_xfer(struct atsha204_chip *chip, char read_write,
+                               u8 command, int size,
+                               union i2c_smbus_data *data)
+{
+        const struct i2c_client *client = chip->client;
+
+        if (chip->bus_locked)
+                return __i2c_smbus_xfer(client->adapter, client->addr,
+                                        client->flags, read_write,
+                                        command, size, data);
+
+        return i2c_smbus_xfer(client->adapter, client->addr, client->flags,
+                              read_write, command, size, data);
+}
+
+/*
+ * The first byte of every packet is the word address, which maps onto
+ * the SMBus command byte. Only I2C block writes of up to 32 bytes
+ * after it are possible, leaving 25 bytes of data once the count,
+ * opcode, params and CRC are in. That rules out every command that
+ * carries a 32 byte value: Write of a whole slot, MAC with a
+ * challenge, CheckMac, Nonce and GenDig with 32 bytes of input, SHA
+ * updates and DeriveKey with a MAC. atsha204_execute_cmd() turns
+ * these away before waking the chip, using max_packet.
+ */
+static int atsha204_smbus_send(struct atsha204_chip *chip, const u8 *buf,
+                               int len)
+{
+        union i2c_smbus_data data;
+        int rc;
+
+        if (len < 1)
+                return -EINVAL;
+
+        if (len - 1 > I2C_SMBUS_BLOCK_MAX)
+                return -EMSGSIZE;
+
+        if (1 == len)
+                rc = atsha204_smbus_xfer(chip, I2C_SMBUS_WRITE, buf[0],
+                                         I2C_SMBUS_BYTE, NULL);
+        else{
+                data.block[0] = len - 1;
+                memcpy(&data.block[1], &buf[1], len - 1);
+                rc = atsha204_smbus_xfer(chip, I2C_SMBUS_WRITE, buf[0],
+                                         I2C_SMBUS_I2C_BLOCK_DATA, &data);
+        }
+
+        return rc ? rc : len;
+}
+
+/*
+ * A block read would first write a command byte, which the chip takes
+ * as a word address and resets its output buffer on. Receive byte
+ * reads continue where the last one stopped instead.
+ */
+static int atsha204_smbus_recv(struct atsha204_chip *chip, u8 *buf, int len)
+{
+        union i2c_smbus_data data;
+        int i, rc;
+
+        for (i = 0; i < len; i++){
+                if ((rc = atsha204_smbus_xfer(chip, I2C_SMBUS_READ, 0,
+                                              I2C_SMBUS_BYTE, &data)))
+                        return rc;
+
+                buf[i] = data.byte;
+        }
+
+        return len;
+}
+
+static int atsha204_smbus_wake(struct atsha204_chip *chip)
+{
+        const int len = sizeof(atsha204_wake_pulse);
+        int rc = atsha204_smbus_send(chip, atsha204_wake_pulse, len);
+
+        return (len == rc) ? 0 : ((rc < 0) ? rc : -EIO);
+}
+
+const struct atsha204_transport atsha204_smbus_transport = {
+        .name = "smbus",
+        .max_packet = 1 + I2C_SMBUS_BLOCK_MAX,
+        .send = atsha204_smbus_send,
+        .recv = atsha204_smbus_recv,
+        .wake = atsha204_smbus_wake,
+        .lock = atsha204_i2c_lock,
+        .unlock = atsha204_i2c_unlock,
+        .recover = atsha204_i2c_recover_bus,
+};
+
+/* Pick the backend the client's adapter can drive, if any */
+const struct atsha204_transport *
+atsha204_transport_for(const struct i2c_client *client)
+{
+        if (i2c_check_functionality(client->adapter, I2C_FUNC_I2C))
+                return &atsha204_raw_transport;
+
+        if (i2c_check_functionality(client->adapter,
+                                    I2C_FUNC_SMBUS_BYTE |
+                                    I2C_FUNC_SMBUS_WRITE_I2C_BLOCK))
+                return &atsha204_smbus_transport;
+
+        return NULL;
+}
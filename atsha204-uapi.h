@@ -0,0 +1,88 @@
+/* -*- mode: c; c-file-style: "linux" -*- */
+/*
+ * User space interface of the ATSHA204 driver
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Shared by the driver and by programs using /dev/atshaX, so only
+ * headers that exist on both sides may be included here.
+ */
+#ifndef _ATSHA204_UAPI_H_
+#define _ATSHA204_UAPI_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * Classes on the chip's transaction queue, highest priority first.
+ * A waiting request of a lower class is still served once it has
+ * waited longer than the driver's starvation limit.
+ */
+enum atsha204_prio {
+        ATSHA204_PRIO_INTERACTIVE = 0,  /* /dev/atshaX, the default */
+        ATSHA204_PRIO_KERNEL,           /* other kernel drivers */
+        ATSHA204_PRIO_RNG,              /* /dev/hwrng */
+        ATSHA204_PRIO_SYSFS,            /* sysfs reads */
+        ATSHA204_PRIO_COUNT,
+};
+
+#define ATSHA204_IOC_MAGIC 0xA2
+
+/* Priority class of commands written to this file descriptor */
+#define ATSHA204_IOC_SET_PRIO _IOW(ATSHA204_IOC_MAGIC, 1, __u32)
+#define ATSHA204_IOC_GET_PRIO _IOR(ATSHA204_IOC_MAGIC, 2, __u32)
+
+/*
+ * One chip transaction, as captured in the debugfs trace file
+ * (/sys/kernel/debug/atsha204/atshaX/trace). Reads return whole
+ * records, oldest first, and remove them from the ring.
+ */
+struct atsha204_trace_rec {
+        __u64 timestamp_ns;     /* CLOCK_MONOTONIC at submission */
+        __u32 latency_us;       /* submission to completion */
+        __u32 queue_us;         /* part of latency spent queued */
+        __u16 tx_len;           /* command bytes, opcode to end of data */
+        __u16 rx_len;           /* response bytes, without count and CRC */
+        __u16 param2;
+        __u8 opcode;
+        __u8 param1;
+        __s16 error;            /* 0 or a negative errno */
+        __u8 chip_status;       /* status byte of a bare status packet */
+        __u8 prio;              /* enum atsha204_prio */
+        __u8 flags;             /* ATSHA204_TRACE_* */
+        __u8 reserved[3];
+};
+
+/* Answered with a copy of an identical command already in flight */
+#define ATSHA204_TRACE_JOINED (1 << 0)
+
+#define ATSHA204_SNAPSHOT_MAGIC 0x34414853   /* "SHA4" */
+#define ATSHA204_SNAPSHOT_VERSION 1
+
+/* Which parts of the snapshot hold data read from the chip */
+#define ATSHA204_SNAPSHOT_CONFIG (1 << 0)       /* config and serial */
+#define ATSHA204_SNAPSHOT_REVISION (1 << 1)
+#define ATSHA204_SNAPSHOT_OTP (1 << 2)          /* only once locked */
+
+/*
+ * Read-only page mapped by mmap() of /dev/atshaX at offset 0. It is
+ * filled after probe and rewritten after every successful Lock and
+ * config or OTP zone Write. generation is odd while the driver is
+ * rewriting the page: read it, copy the fields, and retry if it was
+ * odd or has changed since.
+ */
+struct atsha204_snapshot {
+        __u32 magic;
+        __u32 version;
+        __u32 generation;
+        __u32 flags;            /* ATSHA204_SNAPSHOT_* */
+        __u8 serial[9];
+        __u8 reserved[3];
+        __u8 revision[4];       /* DevRev response */
+        __u8 config[88];
+        __u8 otp[64];
+};
+
+#endif /* _ATSHA204_UAPI_H_ */
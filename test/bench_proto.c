@@ -0,0 +1,116 @@
+/*
+ * Microbenchmarks for the ATSHA204 protocol core: building command
+ * packets and validating responses, the per-transaction CPU work
+ * the driver does around each bus access.
+ *
+ * Build and run with: make bench
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "atsha204-proto.h"
+
+#define ITERATIONS 1000000
+
+static volatile int sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double start, double end)
+{
+    printf("%-32s %8.1f ns/op\n", name, (end - start) / ITERATIONS);
+}
+
+static void bench_frame_read(void)
+{
+    /* Read config word 0x15 */
+    uint8_t packet[ATSHA204_PACKET_LEN(4)] = {0, 0, 0x02, 0x00, 0x15, 0x00};
+    double start;
+    int i;
+
+    start = now_ns();
+    for (i = 0; i < ITERATIONS; i++){
+        packet[4] = i & 0x15;
+        sink = atsha204_frame_command(packet, 4);
+    }
+    report("frame Read", start, now_ns());
+}
+
+static void bench_frame_largest(void)
+{
+    /* CheckMac carries the largest command the chip accepts */
+    uint8_t packet[ATSHA204_RSP_MAX_LEN];
+    const size_t cmd_len = ATSHA204_RSP_MAX_LEN - 4;
+    double start;
+    int i;
+
+    memset(packet, 0xA5, sizeof(packet));
+    packet[ATSHA204_CMD_OFFSET] = 0x28;
+
+    start = now_ns();
+    for (i = 0; i < ITERATIONS; i++){
+        packet[5] = i;
+        sink = atsha204_frame_command(packet, cmd_len);
+    }
+    report("frame CheckMac (84 bytes)", start, now_ns());
+}
+
+static void bench_validate(const char *name, int data_len)
+{
+    uint8_t raw[ATSHA204_RSP_MAX_LEN];
+    struct atsha204_buffer packet = {raw, data_len + 3};
+    struct atsha204_buffer rsp;
+    uint16_t crc;
+    double start;
+    int i;
+
+    memset(raw, 0x5A, sizeof(raw));
+    raw[0] = packet.len;
+    crc = atsha204_crc16(raw, packet.len - 2);
+    raw[packet.len - 2] = crc & 0xFF;
+    raw[packet.len - 1] = crc >> 8;
+
+    start = now_ns();
+    for (i = 0; i < ITERATIONS; i++)
+        sink = atsha204_i2c_validate_rsp(&packet, &rsp);
+    report(name, start, now_ns());
+
+    if (sink != 0)
+        printf("  unexpected validation failure %d\n", sink);
+}
+
+static void bench_packet_len(void)
+{
+    uint8_t status[4] = {35, 0, 0, 0};
+    double start;
+    int i;
+
+    start = now_ns();
+    for (i = 0; i < ITERATIONS; i++){
+        status[0] = 4 + (i & 0x1F);
+        sink = atsha204_rsp_packet_len(status);
+    }
+    report("response length check", start, now_ns());
+}
+
+int main(void)
+{
+    printf("%d iterations per benchmark\n", ITERATIONS);
+
+    bench_frame_read();
+    bench_frame_largest();
+    bench_packet_len();
+    bench_validate("validate status response", 1);
+    bench_validate("validate 4 byte Read", 4);
+    bench_validate("validate 32 byte Random", 32);
+
+    return 0;
+}
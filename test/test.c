@@ -5,10 +5,12 @@
 #include <unistd.h>
 #include <linux/i2c-dev.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include "../atsha204-uapi.h"
 
 static char buf[] = {0x1B, 0x01, 0x00, 0x00};
 static char recv_buf[32];
@@ -62,6 +64,95 @@ int test_single_byte_read(int fd)
 
 }
 
+int test_priority(int fd)
+{
+    uint32_t prio = ATSHA204_PRIO_RNG;
+    uint32_t got = 0;
+
+    printf("Starting priority ioctl test\n");
+
+    if (ioctl(fd, ATSHA204_IOC_SET_PRIO, &prio) ||
+        ioctl(fd, ATSHA204_IOC_GET_PRIO, &got) || got != prio){
+        perror("Priority round trip failed");
+        return 1;
+    }
+
+    prio = ATSHA204_PRIO_COUNT;
+    if (ioctl(fd, ATSHA204_IOC_SET_PRIO, &prio) == 0 || errno != EINVAL){
+        printf("Invalid priority accepted\n");
+        return 1;
+    }
+
+    prio = ATSHA204_PRIO_INTERACTIVE;
+
+    return ioctl(fd, ATSHA204_IOC_SET_PRIO, &prio) ? 1 : 0;
+}
+
+int test_snapshot(int fd)
+{
+    const struct atsha204_snapshot *snap;
+    uint32_t gen;
+    uint8_t serial[9];
+    int rc = 0;
+
+    printf("Starting snapshot mmap test\n");
+
+    snap = mmap(NULL, sizeof(*snap), PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == snap){
+        perror("Snapshot mmap failed");
+        return 1;
+    }
+
+    if (mmap(NULL, sizeof(*snap), PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0) != MAP_FAILED){
+        printf("Writable snapshot mapping accepted\n");
+        rc = 1;
+    }
+
+    if (snap->magic != ATSHA204_SNAPSHOT_MAGIC ||
+        snap->version != ATSHA204_SNAPSHOT_VERSION){
+        printf("Bad snapshot magic or version\n");
+        rc = 1;
+        goto out;
+    }
+
+    do {
+        gen = __atomic_load_n(&snap->generation, __ATOMIC_ACQUIRE);
+        memcpy(serial, snap->serial, sizeof(serial));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((gen & 1) || gen != snap->generation);
+
+    if (!(snap->flags & ATSHA204_SNAPSHOT_CONFIG) ||
+        serial[0] != 0x01 || serial[1] != 0x23){
+        printf("Snapshot has no serial number\n");
+        rc = 1;
+    }
+    else
+        print_hex("Snapshot serial", serial, sizeof(serial));
+
+out:
+    munmap((void *)snap, sizeof(*snap));
+
+    return rc;
+}
+
+/* A read-only open for the snapshot must not need the command slot */
+int test_snapshot_observer()
+{
+    int fd;
+    int rc;
+
+    if ((fd = open(filename, O_RDONLY)) < 0){
+        perror("Read-only open while busy");
+        return 1;
+    }
+
+    rc = test_snapshot(fd);
+    close(fd);
+
+    return rc;
+}
+
 int test_multiple_open()
 {
     int rc = -1;
@@ -116,6 +207,24 @@ int main()
         goto close_exit;
     }
 
+    if (test_priority(file)){
+        printf("Priority test failed\n");
+        rc = 1;
+        goto close_exit;
+    }
+
+    if (test_snapshot(file)){
+        printf("Snapshot test failed\n");
+        rc = 1;
+        goto close_exit;
+    }
+
+    if (test_snapshot_observer()){
+        printf("Read-only snapshot open failed\n");
+        rc = 1;
+        goto close_exit;
+    }
+
     if (test_multiple_open()){
         printf("Multiple open failed\n");
         rc = 1;
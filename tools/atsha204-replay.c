@@ -0,0 +1,380 @@
+/*
+ * Replay a captured ATSHA204 transaction trace against /dev/atshaX and
+ * report throughput and latency.
+ *
+ * Capture:
+ *   echo Y > /sys/kernel/debug/atsha204/atsha0/trace_enable
+ *   ... run the real workload ...
+ *   cat /sys/kernel/debug/atsha204/atsha0/trace > capture.bin
+ *
+ * Replay:
+ *   atsha204-replay [-d /dev/atsha0] [-s speed | -m] capture.bin
+ *
+ * Each record is turned back into a command with the captured
+ * opcode, params and length. Command data is not captured, so it is
+ * replayed as zeros; the chip does the same amount of work for it.
+ *
+ * Zeros written to a slot or a Lock that skips the CRC check would
+ * change the chip for good, so commands that modify the chip are
+ * skipped and counted unless --allow-writes is given.
+ *
+ * Commands go out one at a time on a single descriptor. When the chip
+ * falls behind the captured rate, the next command starts late, so
+ * latency is measured from when it was due and the delay before it
+ * could be sent is reported as backlog. Being a single client, replay
+ * can't reproduce several processes contending for the chip, and the
+ * hwrng, sysfs and in-kernel commands in the capture go through the
+ * device file like the rest, in the interactive class.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../atsha204-proto.h"
+#include "../atsha204-uapi.h"
+
+#define MAX_CMD_LEN 251
+#define MAX_RSP_LEN 84
+
+struct result {
+    uint8_t opcode;
+    int failed;
+    int skipped;
+    double latency_us;          /* from when the command was due */
+    double backlog_us;          /* how late it was sent */
+};
+
+/* Commands that change EEPROM, lock state or counters */
+static int modifies_chip(uint8_t opcode)
+{
+    switch (opcode){
+    case ATSHA204_OP_WRITE:
+    case ATSHA204_OP_LOCK:
+    case ATSHA204_OP_DERIVEKEY:
+    case ATSHA204_OP_UPDATEEXTRA:
+    case ATSHA204_OP_GENKEY:
+    case ATSHA204_OP_PRIVWRITE:
+    case ATSHA204_OP_COUNTER:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sleep_until_us(double target)
+{
+    double delta = target - now_us();
+    struct timespec ts;
+
+    if (delta <= 0)
+        return;
+
+    ts.tv_sec = delta / 1e6;
+    ts.tv_nsec = (delta - ts.tv_sec * 1e6) * 1e3;
+    nanosleep(&ts, NULL);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, double p)
+{
+    size_t i;
+
+    if (0 == n)
+        return 0;
+
+    i = p / 100.0 * (n - 1) + 0.5;
+
+    return sorted[i];
+}
+
+static struct atsha204_trace_rec *load_trace(const char *path, size_t *n)
+{
+    struct atsha204_trace_rec *recs = NULL;
+    size_t cap = 0;
+    size_t got = 0;
+    FILE *f;
+
+    if (!(f = fopen(path, "rb"))){
+        perror(path);
+        return NULL;
+    }
+
+    for (;;){
+        if (got == cap){
+            cap = cap ? cap * 2 : 1024;
+            recs = realloc(recs, cap * sizeof(*recs));
+            if (!recs){
+                perror("realloc");
+                fclose(f);
+                return NULL;
+            }
+        }
+
+        if (1 != fread(&recs[got], sizeof(*recs), 1, f))
+            break;
+
+        got++;
+    }
+
+    fclose(f);
+    *n = got;
+
+    return recs;
+}
+
+static int replay_one(int fd, const struct atsha204_trace_rec *rec)
+{
+    uint8_t cmd[MAX_CMD_LEN] = {0};
+    uint8_t rsp[MAX_RSP_LEN];
+    size_t len = rec->tx_len;
+
+    if (len < 4 || len > sizeof(cmd))
+        return -EINVAL;
+
+    cmd[0] = rec->opcode;
+    cmd[1] = rec->param1;
+    cmd[2] = rec->param2 & 0xFF;
+    cmd[3] = rec->param2 >> 8;
+
+    if (write(fd, cmd, len) != (ssize_t)len)
+        return -errno;
+
+    if (read(fd, rsp, sizeof(rsp)) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static void report(const struct atsha204_trace_rec *recs,
+                   const struct result *res, size_t n, double elapsed_us,
+                   int paced)
+{
+    double *lat = malloc(n * sizeof(*lat));
+    size_t late = 0;
+    double captured = 0;
+    size_t failed = 0;
+    size_t skipped = 0;
+    size_t joined = 0;
+    size_t run = 0;
+    size_t i, count;
+    int op;
+
+    if (!lat)
+        return;
+
+    for (i = 0; i < n; i++){
+        if (res[i].skipped){
+            skipped++;
+            continue;
+        }
+
+        lat[run++] = res[i].latency_us;
+        captured += recs[i].latency_us;
+        failed += res[i].failed;
+        joined += !!(recs[i].flags & ATSHA204_TRACE_JOINED);
+        late += res[i].backlog_us >= 1000;
+    }
+
+    printf("Replayed %zu commands in %.3f s, %.1f cmd/s, %zu failed\n",
+           run, elapsed_us / 1e6, run / (elapsed_us / 1e6), failed);
+
+    if (skipped)
+        printf("Skipped %zu commands that modify the chip"
+               " (use --allow-writes to send them)\n", skipped);
+
+    if (joined)
+        printf("%zu of them were coalesced with an identical command"
+               " when captured\n", joined);
+
+    if (0 == run){
+        free(lat);
+        return;
+    }
+
+    qsort(lat, run, sizeof(*lat), cmp_double);
+
+    printf("Latency us: p50 %.0f  p90 %.0f  p99 %.0f  max %.0f"
+           "  (captured mean %.0f)\n",
+           percentile(lat, run, 50), percentile(lat, run, 90),
+           percentile(lat, run, 99), lat[run - 1], captured / run);
+
+    if (paced){
+        for (i = 0, count = 0; i < n; i++)
+            if (!res[i].skipped)
+                lat[count++] = res[i].backlog_us;
+
+        qsort(lat, count, sizeof(*lat), cmp_double);
+
+        printf("Backlog us: p50 %.0f  p99 %.0f  max %.0f"
+               "  (%zu commands sent 1 ms or more late)\n",
+               percentile(lat, count, 50), percentile(lat, count, 99),
+               lat[count - 1], late);
+    }
+
+    printf("%-8s %8s %8s %10s %10s\n", "opcode", "count", "skipped",
+           "p50 us", "p99 us");
+
+    for (op = 0; op < 256; op++){
+        size_t op_skipped = 0;
+
+        for (i = 0, count = 0; i < n; i++){
+            if (res[i].opcode != op)
+                continue;
+
+            if (res[i].skipped)
+                op_skipped++;
+            else
+                lat[count++] = res[i].latency_us;
+        }
+
+        if (0 == count && 0 == op_skipped)
+            continue;
+
+        qsort(lat, count, sizeof(*lat), cmp_double);
+        printf("0x%02X     %8zu %8zu %10.0f %10.0f\n", op, count,
+               op_skipped, percentile(lat, count, 50),
+               percentile(lat, count, 99));
+    }
+
+    free(lat);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d device] [-s speed | -m] [--allow-writes]"
+            " trace.bin\n"
+            "  -d  device to replay against (default /dev/atsha0)\n"
+            "  -s  replay at this multiple of the captured rate (default 1)\n"
+            "  -m  replay back to back, as fast as the chip allows\n"
+            "  --allow-writes\n"
+            "      also send Write, Lock, DeriveKey, UpdateExtra, GenKey,\n"
+            "      PrivWrite and Counter, with zeroed data. This can\n"
+            "      overwrite slots and lock the chip for good\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = "/dev/atsha0";
+    struct atsha204_trace_rec *recs;
+    struct result *res;
+    double speed = 1.0;
+    int max_rate = 0;
+    int allow_writes = 0;
+    double start, due, sent;
+    size_t n, i;
+    int fd, opt;
+    static const struct option long_opts[] = {
+        {"allow-writes", no_argument, NULL, 'W'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "d:s:mh", long_opts,
+                              NULL)) != -1){
+        switch (opt){
+        case 'W':
+            allow_writes = 1;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        case 's':
+            speed = atof(optarg);
+            if (speed <= 0){
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            max_rate = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1){
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!(recs = load_trace(argv[optind], &n)))
+        return 1;
+
+    if (0 == n){
+        fprintf(stderr, "%s: no records\n", argv[optind]);
+        return 1;
+    }
+
+    if (!(res = calloc(n, sizeof(*res)))){
+        perror("calloc");
+        return 1;
+    }
+
+    if (allow_writes)
+        fprintf(stderr,
+                "WARNING: --allow-writes replays state changing commands"
+                " with zeroed data.\n"
+                "WARNING: slots on %s may be overwritten and its zones"
+                " locked permanently.\n", device);
+
+    if ((fd = open(device, O_RDWR)) < 0){
+        perror(device);
+        return 1;
+    }
+
+    start = now_us();
+
+    for (i = 0; i < n; i++){
+        if (max_rate)
+            due = now_us();
+        else{
+            due = start + (recs[i].timestamp_ns - recs[0].timestamp_ns) /
+                1e3 / speed;
+            sleep_until_us(due);
+        }
+
+        res[i].opcode = recs[i].opcode;
+
+        if (!allow_writes && modifies_chip(recs[i].opcode)){
+            res[i].skipped = 1;
+            continue;
+        }
+
+        sent = now_us();
+        res[i].backlog_us = (sent > due) ? sent - due : 0;
+        res[i].failed = replay_one(fd, &recs[i]) ? 1 : 0;
+        res[i].latency_us = now_us() - due;
+    }
+
+    report(recs, res, n, now_us() - start, !max_rate);
+
+    close(fd);
+    free(res);
+    free(recs);
+
+    return 0;
+}